@@ -47,11 +47,10 @@ any part thereof, the company/individual will have to contact Filmakademie
 
 namespace DataHub {
 
-    QHash<int64_t, SyncServer::cID> SyncServer::m_clientIDs;
-    QList<int64_t> SyncServer::m_clientsInactive;
+    ClientIDAllocator SyncServer::m_clientIDs;
 
 
-    SyncServer::SyncServer() : m_ownIP(""), m_debug(false), m_lockHistory(true), m_paramHistory(true), m_context(new zmq::context_t(1)), m_isRunning(false), m_webSockets(false)
+    SyncServer::SyncServer() : m_ownIP(""), m_debug(false), m_lockHistory(true), m_paramHistory(true), m_conflateUpdates(false), m_extendedIDs(false), m_sceneCatalog(nullptr), m_sceneSender(nullptr), m_scenePartCache(nullptr), m_sceneCacheSize(256), m_chunkedScenes(false), m_relayScenes(false), m_deltaScenes(false), m_batchDivisor(0), m_context(new zmq::context_t(1)), m_isRunning(false), m_webSockets(false)
     {
     }
 
@@ -117,6 +116,43 @@ namespace DataHub {
                         std::cout << "No lock history." << std::endl;
                         m_lockHistory = false;
                     }
+                    else if (commands[i] == "-cf")
+                    {
+                        std::cout << "Parameter updates conflated per tick." << std::endl;
+                        m_conflateUpdates = true;
+                    }
+                    else if (commands[i] == "-ext")
+                    {
+                        std::cout << "16 bit client IDs enabled." << std::endl;
+                        m_extendedIDs = true;
+                    }
+                    else if (commands[i] == "-cs")
+                    {
+                        std::cout << "Scenes received in resumable chunks." << std::endl;
+                        m_chunkedScenes = true;
+                    }
+                    else if (commands[i] == "-sc" && commands.length() > i + 1 && commands[i + 1].toLongLong() > 0)
+                    {
+                        m_sceneCacheSize = commands[++i].toLongLong();
+                        std::cout << "Scene part cache of " << m_sceneCacheSize << " MiB." << std::endl;
+                    }
+                    else if (commands[i] == "-delta")
+                    {
+                        std::cout << "Scenes received as delta of the last stored version." << std::endl;
+                        m_deltaScenes = true;
+                    }
+                    else if (commands[i] == "-relay")
+                    {
+                        std::cout << "Received scenes relayed to clients while they are stored." << std::endl;
+                        m_relayScenes = true;
+                    }
+                    else if (commands[i] == "-batch")
+                    {
+                        m_batchDivisor = 1;
+                        if (commands.length() > i + 1 && commands[i + 1].toInt() > 0)
+                            m_batchDivisor = commands[++i].toInt();
+                        std::cout << "Messages batched every " << m_batchDivisor << " tick(s)." << std::endl;
+                    }
                     else if (commands[i] == "-ownIP" && commands.length() > i+1)
                     {
                         m_ownIP = "f";
@@ -152,37 +188,78 @@ namespace DataHub {
 
     void SyncServer::stop()
     {
+        // received scenes are completed by the I/O thread, which reports to the scene service and catalog
+        foreach (ZeroMQHandler *handler, m_handlerlist)
+        {
+            if (qobject_cast<SceneReceiver*>(handler))
+                cleanupHandler(handler);
+        }
+        SceneWriter::waitForDone();
+
         foreach (ZeroMQHandler *handler, m_handlerlist)
         {
             cleanupHandler(handler);
         }
 
+        m_sceneSender = nullptr;
+
         m_context->shutdown();
         m_context->close();
+
+        delete m_sceneCatalog;
+        m_sceneCatalog = nullptr;
+        delete m_scenePartCache;
+        m_scenePartCache = nullptr;
     }
 
     void SyncServer::initServer()
     {
+        // created here so that its file system watcher runs in the main thread's event loop
+        m_sceneCatalog = new SceneCatalog("./");
+        m_scenePartCache = new ScenePartCache("./", m_sceneCacheSize * 1024 * 1024);
+
         MessageSender *messageSenderWS = 0;
         MessageReceiver* messageReceiver = 0;
         MessageReceiver *messageReceiverWS = 0;
         
-        MessageSender* messageSender = new MessageSender(core(), m_ownIP, m_debug, false, m_context);
+        MessageSender *messageSenderExt = 0;
+        
+        MessageSender* messageSender = new MessageSender(core(), m_ownIP, m_debug, false, m_batchDivisor, false, m_context);
+        QList<MessageSender*> messageSenders{ messageSender };
+
+        // clients with 16 bit IDs receive all messages with the extended header from their own sender
+        if (m_extendedIDs)
+        {
+            messageSenderExt = new MessageSender(core(), m_ownIP, m_debug, false, m_batchDivisor, true, m_context);
+            messageSenders.append(messageSenderExt);
+        }
 
         if (m_webSockets)
         {
-            messageSenderWS = new MessageSender(core(), m_ownIP, m_debug, true, m_context);
-            messageReceiverWS = new MessageReceiver(core(), QList<MessageSender*>{ messageSender, messageSenderWS }, m_ownIP, m_debug, true, m_paramHistory, m_lockHistory, m_context);
-            messageReceiver = new MessageReceiver(core(), QList<MessageSender*>{ messageSender, messageSenderWS}, m_ownIP, m_debug, false, m_paramHistory, m_lockHistory, m_context);
+            messageSenderWS = new MessageSender(core(), m_ownIP, m_debug, true, m_batchDivisor, false, m_context);
+            messageReceiverWS = new MessageReceiver(core(), messageSenders + QList<MessageSender*>{ messageSenderWS }, m_ownIP, m_debug, true, m_paramHistory, m_lockHistory, m_conflateUpdates, m_context);
+            messageReceiver = new MessageReceiver(core(), messageSenders + QList<MessageSender*>{ messageSenderWS }, m_ownIP, m_debug, false, m_paramHistory, m_lockHistory, m_conflateUpdates, m_context);
         }
         else
-            messageReceiver = new MessageReceiver(core(), QList<MessageSender*>{ messageSender }, m_ownIP, m_debug, false, m_paramHistory, m_lockHistory, m_context);
+            messageReceiver = new MessageReceiver(core(), messageSenders, m_ownIP, m_debug, false, m_paramHistory, m_lockHistory, m_conflateUpdates, m_context);
 
-        CommandHandler* commandHandler = new CommandHandler(core(), messageSender, messageReceiver, m_ownIP, m_debug, m_context);
+        // one service answers all scene requests on port 5555
+        m_sceneSender = new SceneSender(core(), m_ownIP, m_sceneCatalog, m_scenePartCache, m_debug, m_context);
+        QObject::connect(m_sceneSender, &SceneSender::sceneSent, this, &SyncServer::sceneSend);
+
+        CommandHandler* commandHandler = new CommandHandler(core(), messageSenders, messageReceiver, m_ownIP, m_debug, m_context);
+
+        // clients sending data don't need to ping on the command channel
+        messageReceiver->SetLivenessTracker(commandHandler->livenessTracker());
+        if (messageReceiverWS)
+            messageReceiverWS->SetLivenessTracker(commandHandler->livenessTracker());
 
         initHandler(messageSender);
+        if (m_extendedIDs)
+            initHandler(messageSenderExt);
         initHandler(messageReceiver);
         initHandler(commandHandler);
+        initHandler(m_sceneSender);
 
         if (m_webSockets)
         {
@@ -214,12 +291,20 @@ namespace DataHub {
         std::cout << "-ws:      run with Web Sockets" << std::endl;
         std::cout << "-np:      run without parameter history" << std::endl;
         std::cout << "-nl:      run without lock history" << std::endl;
+        std::cout << "-cf:      conflate parameter updates per tick" << std::endl;
+        std::cout << "-batch n: send messages batched every n ticks (default 1), without it every message is sent right away" << std::endl;
+        std::cout << "-cs:      receive scenes in resumable chunks, the scene server has to support chunked requests" << std::endl;
+        std::cout << "-sc n:    memory budget of the scene part cache in MiB (default 256)" << std::endl;
+        std::cout << "-delta:   receive only the scene data that changed since the last stored version, the scene server has to support delta requests" << std::endl;
+        std::cout << "-relay:   serve received scenes to clients while they are still received and stored" << std::endl;
+        std::cout << "-ext:     accept clients with 16 bit IDs using the extended message header on port 5559" << std::endl;
     }
 
-    void SyncServer::requestScene(byte clientID)
+    void SyncServer::requestScene(quint16 clientID)
     {
         QString cip = getIPString(clientID);
-        ZeroMQHandler *sceneReceiver = new SceneReceiver(core(), cip, false, m_context);
+        const SceneReceiver::TransferMode mode = m_deltaScenes ? SceneReceiver::DELTA : m_chunkedScenes ? SceneReceiver::CHUNKED : SceneReceiver::PARTS;
+        ZeroMQHandler *sceneReceiver = new SceneReceiver(core(), cip, m_sceneCatalog, m_scenePartCache, m_relayScenes ? m_sceneSender : nullptr, mode, false, m_context);
        
         QObject::connect(sceneReceiver, &ZeroMQHandler::stopped, this, &SyncServer::cleanupHandler);
         QObject::connect(sceneReceiver, &ZeroMQHandler::deleted, this, &SyncServer::sceneReceived);
@@ -227,14 +312,12 @@ namespace DataHub {
         initHandler(sceneReceiver);
     }
 
-    void SyncServer::sendScene(QString ip, byte clientID)
+    void SyncServer::sendScene(quint16 clientID)
     {
         QString cip = getMACString(clientID);
-        ZeroMQHandler* sceneSender = new SceneSender(core(), ip, cip , false, m_context);
-
-        QObject::connect(sceneSender, &ZeroMQHandler::stopped, this, &SyncServer::cleanupHandler);
-        QObject::connect(sceneSender, &ZeroMQHandler::deleted, this, &SyncServer::sceneSend);
 
-        initHandler(sceneSender);
+        // the running scene service switches to the scene, clients download it from there,
+        // sceneSend is emitted by the service whenever a client completed the download
+        m_sceneSender->publishScene(cip);
     }
 }
\ No newline at end of file
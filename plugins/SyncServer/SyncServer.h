@@ -40,6 +40,11 @@ any part thereof, the company/individual will have to contact Filmakademie
 #include <QMutex>
 #include "plugininterface.h"
 #include "zeroMQHandler.h"
+#include "clientIDAllocator.h"
+
+class SceneCatalog;
+class SceneSender;
+class ScenePartCache;
 
 
 
@@ -55,69 +60,26 @@ namespace DataHub {
 		SyncServer();
 	
 	public:
-        typedef QPair<bool, byte> cID;
 		virtual void run();
 		virtual void stop();
-		void requestScene(byte clientID);
-		void sendScene(QString ip, byte clientID);
+		void requestScene(quint16 clientID);
+		void sendScene(quint16 clientID);
+
+		//! Returns the index of the scene versions stored on disk.
+		SceneCatalog* sceneCatalog() const { return m_sceneCatalog; }
 
-		static int addClient(const int64_t mac)
+		static int addClient(const int64_t mac, bool extendedID = false)
 		{
-			// hard limit of 250 clients revome old inactive clients first
-			if (m_clientIDs.size() > 249)
-			{
-				if (m_clientsInactive.size() > 0) {
-					qDebug() << "List full, remive Client ID: " << m_clientsInactive[0] << " reactivated.";
-					m_clientIDs.remove(m_clientsInactive.takeFirst());
-				}
-				else
-					return 255;
-			}
-
-			auto valueIter = m_clientIDs.find(mac);
-
-			if (valueIter != m_clientIDs.end())   // ip in list 
-			{
-				if (valueIter->first)    // ip active
-				{
-					qDebug() << "Client ID: " << valueIter->second << " still active.";
-					return valueIter->second;
-				}
-				else   // if ip not active or lost then reactivate
-				{
-					m_clientsInactive.removeAt(m_clientsInactive.indexOf(mac));
-					valueIter->first = true;
-					qDebug() << "Client ID: " << valueIter->second << " reactivated.";
-					return valueIter->second;
-				}
-			}
-			else  // add complete new client
-			{
-				int next = nextFreeID() + 1; // because 0 is DataHub
-				//qDebug() << "New Client added to list with ID: " << next;
-				m_clientIDs.insert(mac, cID(true, next));
-				return next;
-			}
+			const int id = m_clientIDs.allocate(mac, extendedID);
+			if (id == ClientIDAllocator::s_invalidID || id == ClientIDAllocator::s_invalidExtendedID)
+				qDebug() << "Client list full, no client ID left.";
+			return id;
 		}
 
-		static bool removeClient(byte id)
+		static bool removeClient(quint16 id)
 		{
-			int64_t ip = getMacInt(id);
-
-			if (m_clientIDs.size() > 249) 
-			{
-				// remove oldest, inactive client
-				return m_clientIDs.remove(m_clientsInactive.takeFirst());
-			}
-			else if (ip != -1)
-			{
-				m_clientsInactive.append(ip);
-				m_clientIDs[ip].first = false;
-				return true;
-			}
-			else
-				return false;
-        }
+			return m_clientIDs.release(id);
+		}
 
 		static int ipToInt(byte first, byte second, byte third, byte fourth)
 		{
@@ -174,45 +136,33 @@ namespace DataHub {
 		bool m_webSockets;
 		bool m_lockHistory;
 		bool m_paramHistory;
+		bool m_conflateUpdates;
+		bool m_extendedIDs;
+		SceneCatalog* m_sceneCatalog;
+		SceneSender* m_sceneSender;
+		ScenePartCache* m_scenePartCache;
+		qint64 m_sceneCacheSize;
+		bool m_chunkedScenes;
+		bool m_relayScenes;
+		bool m_deltaScenes;
+		int m_batchDivisor;
 		bool m_isRunning;
 		zmq::context_t *m_context;
 		QList<ZeroMQHandler*> m_handlerlist;
-        static QHash<int64_t, cID> m_clientIDs;
-		static QList<int64_t> m_clientsInactive;
-
-        static byte nextFreeID()
-        {
-            int i = 0;
-
-            if (!m_clientIDs.empty())
-            {
-                QList<cID> keys = m_clientIDs.values();
-				std::sort(keys.begin(), keys.end(), [&](const cID& c1, const cID& c2) { return c1.second < c2.second; });
-                for (; i < keys.size() - 1;)
-                {
-                    if (keys[i + 1].second - keys[i].second > 1)
-                        break;
-                    i++;
-                }
-
-                i++;
-            }
-
-            return i;
-        }
-
-		static int64_t getMacInt(const byte clientID)
+        static ClientIDAllocator m_clientIDs;
+
+		static int64_t getMacInt(const quint16 clientID)
 		{
-			return m_clientIDs.key(cID(true, clientID), -1);
+			return m_clientIDs.mac(clientID);
 		}
 
-		static QString getIPString(const byte clientID)
+		static QString getIPString(const quint16 clientID)
 		{
 			//return IntToIp(getIPInt(clientID)
 			return IntToIp(0); // not defined because of gateway problem! 
 		}
 
-		static QString getMACString(const byte clientID)
+		static QString getMACString(const quint16 clientID)
 		{
 			return IntToMac(getMacInt(clientID));
 		}
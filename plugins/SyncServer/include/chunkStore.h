@@ -0,0 +1,472 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <QDir>
+#include <QSaveFile>
+#include <QMutex>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QDebug>
+#include <memory>
+#include "sharedBuffer.h"
+#include "hash.h"
+
+//!
+//! Store of the chunks of a server's scene versions, in pack files next to their manifests.
+//! Data is cut into chunks at content defined boundaries, so that unchanged ranges give
+//! the same chunks even if data before them changed size. A version only appends the
+//! chunks no earlier version stored to its pack, which is synced and renamed once, when
+//! the version is complete. The chunk lists let a client holding an earlier version fetch
+//! only the chunks that changed as well.
+//! Ranges are verified against their checksum the first time they are mapped.
+//! Packs no version refers to any more are deleted by collect.
+//!
+class ChunkStore
+{
+public:
+    //! Identity, size and location of a chunk.
+    struct Chunk
+    {
+        quint64 hash;
+        //! Second hash with another seed, the two together identify the chunk.
+        quint64 check;
+        qint64 size;
+        //! The pack holding the chunk, 0 if it is not stored.
+        quint64 pack = 0;
+        //! The offset of the chunk in its pack.
+        qint64 offset = 0;
+
+        //! Chunks are equal by content, wherever they are stored.
+        bool operator==(const Chunk& other) const
+        {
+            return hash == other.hash && check == other.check && size == other.size;
+        }
+
+        friend size_t qHash(const Chunk& chunk, size_t seed)
+        {
+            return qHashMulti(seed, chunk.hash, chunk.check);
+        }
+    };
+
+    //! Size of a chunk in a chunk list, [hash : 8][check : 8][size : 8] little endian.
+    static const qint64 s_encodedChunkSize = 24;
+    //! Size of a chunk in a manifest, the encoded chunk followed by [pack : 8][offset : 8].
+    static const qint64 s_storedChunkSize = 40;
+
+    //! Chunks are never smaller, except for the last one of the data.
+    static const qint64 s_minChunkSize = 32 * 1024;
+    //! Chunks are cut at the latest here.
+    static const qint64 s_maxChunkSize = 512 * 1024;
+
+    //! The new chunks of a part start at multiples of this in their pack, so that they have pages of their own.
+    static const qint64 s_alignment = 4096;
+
+    //! File name extension of packs, the name is the hexadecimal pack number.
+    inline static const QString s_packExtension {".pack"};
+
+    //!
+    //! A pack being written. Nothing of it is visible until it is committed,
+    //! a pack that is destroyed before is discarded.
+    //!
+    class Pack
+    {
+    public:
+        explicit Pack(const ChunkStore& store) : m_path(store.path())
+        {
+        }
+
+        Pack(const Pack&) = delete;
+        Pack& operator=(const Pack&) = delete;
+
+        //! The number of the pack, 0 until data was appended.
+        quint64 id() const { return m_id; }
+
+        //! Lets the next data appended start at a page boundary.
+        void align()
+        {
+            m_aligned = false;
+        }
+
+        //!
+        //! Appends data to the pack, directly after the data before unless align was called.
+        //! The pack file is created with the first data.
+        //!
+        //! @param data The data.
+        //! @param size The size of the data.
+        //! @return The offset of the data in the pack, -1 if it could not be written.
+        //!
+        qint64 append(const char* data, qint64 size)
+        {
+            if (!m_file)
+            {
+                // a random number, so that a pack is never replaced by another one
+                do
+                    m_id = QRandomGenerator::global()->generate64();
+                while (m_id == 0 || QFile::exists(packPath(m_path, m_id)));
+
+                QDir().mkpath(m_path);
+                m_file.reset(new QSaveFile(packPath(m_path, m_id)));
+                if (!m_file->open(QIODevice::WriteOnly))
+                    return failed();
+            }
+
+            static const char padding[s_alignment] = {};
+            const qint64 offset = m_aligned ? m_size : (m_size + s_alignment - 1) / s_alignment * s_alignment;
+
+            if (m_file->write(padding, offset - m_size) != offset - m_size || m_file->write(data, size) != size)
+                return failed();
+
+            m_size = offset + size;
+            m_aligned = true;
+            return offset;
+        }
+
+        //! Syncs the pack to disk and renames it, returns false if it could not be written.
+        bool commit()
+        {
+            if (!m_file)
+                return true;
+
+            if (!m_file->commit())
+            {
+                failed();
+                return false;
+            }
+
+            m_file.reset();
+            return true;
+        }
+
+        //! Removes the data appended so far, the pack is never committed.
+        void discard()
+        {
+            m_file.reset();
+        }
+
+    private:
+        const QString m_path;
+        std::unique_ptr<QSaveFile> m_file;
+        quint64 m_id = 0;
+        qint64 m_size = 0;
+        bool m_aligned = false;
+
+        qint64 failed()
+        {
+            qWarning() << "Could not write pack" << packPath(m_path, m_id) << m_file->errorString();
+            return -1;
+        }
+    };
+
+    //!
+    //! Constructor
+    //!
+    //! @param path The directory of the pack files.
+    //!
+    explicit ChunkStore(QString path) : m_path(path)
+    {
+    }
+
+    //! The directory of the pack files.
+    const QString& path() const { return m_path; }
+
+    //!
+    //! Cuts the data into chunks.
+    //!
+    //! @param data The data.
+    //! @param size The size of the data.
+    //! @return The chunks covering the data in order.
+    //!
+    static QList<Chunk> chunks(const char* data, qint64 size)
+    {
+        QList<Chunk> chunks;
+
+        for (qint64 start = 0; start < size;)
+        {
+            const qint64 length = boundary(data + start, size - start);
+            chunks.append(identify(data + start, length));
+            start += length;
+        }
+
+        return chunks;
+    }
+
+    //! Returns the identity of a chunk of data.
+    static Chunk identify(const char* data, qint64 size)
+    {
+        return Chunk { Hash::xxh64(data, size), Hash::xxh64(data, size, s_checkSeed), size };
+    }
+
+    //! Appends the chunks to a chunk list, as sent to clients.
+    static void encode(const QList<Chunk>& chunks, QByteArray& target)
+    {
+        qsizetype offset = target.size();
+        target.resize(offset + chunks.size() * s_encodedChunkSize);
+
+        foreach(const Chunk& chunk, chunks)
+        {
+            uchar* p = reinterpret_cast<uchar*>(target.data() + offset);
+            qToLittleEndian<quint64>(chunk.hash, p);
+            qToLittleEndian<quint64>(chunk.check, p + 8);
+            qToLittleEndian<quint64>(static_cast<quint64>(chunk.size), p + 16);
+            offset += s_encodedChunkSize;
+        }
+    }
+
+    //! Reads count chunks of a chunk list, the data has to hold them.
+    static QList<Chunk> decode(const void* data, qint64 count)
+    {
+        QList<Chunk> chunks;
+        chunks.reserve(count);
+
+        const uchar* p = static_cast<const uchar*>(data);
+        for (qint64 i = 0; i < count; i++, p += s_encodedChunkSize)
+            chunks.append(Chunk { qFromLittleEndian<quint64>(p), qFromLittleEndian<quint64>(p + 8), static_cast<qint64>(qFromLittleEndian<quint64>(p + 16)) });
+
+        return chunks;
+    }
+
+    //! Appends the chunks with their locations to a chunk list, as stored in manifests.
+    static void encodeStored(const QList<Chunk>& chunks, QByteArray& target)
+    {
+        qsizetype offset = target.size();
+        target.resize(offset + chunks.size() * s_storedChunkSize);
+
+        foreach(const Chunk& chunk, chunks)
+        {
+            uchar* p = reinterpret_cast<uchar*>(target.data() + offset);
+            qToLittleEndian<quint64>(chunk.hash, p);
+            qToLittleEndian<quint64>(chunk.check, p + 8);
+            qToLittleEndian<quint64>(static_cast<quint64>(chunk.size), p + 16);
+            qToLittleEndian<quint64>(chunk.pack, p + 24);
+            qToLittleEndian<quint64>(static_cast<quint64>(chunk.offset), p + 32);
+            offset += s_storedChunkSize;
+        }
+    }
+
+    //! Reads count chunks of a chunk list written by encodeStored, the data has to hold them.
+    static QList<Chunk> decodeStored(const void* data, qint64 count)
+    {
+        QList<Chunk> chunks;
+        chunks.reserve(count);
+
+        const uchar* p = static_cast<const uchar*>(data);
+        for (qint64 i = 0; i < count; i++, p += s_storedChunkSize)
+        {
+            chunks.append(Chunk { qFromLittleEndian<quint64>(p), qFromLittleEndian<quint64>(p + 8), static_cast<qint64>(qFromLittleEndian<quint64>(p + 16)),
+                qFromLittleEndian<quint64>(p + 24), static_cast<qint64>(qFromLittleEndian<quint64>(p + 32)) });
+        }
+
+        return chunks;
+    }
+
+    //!
+    //! Maps a stored range. The range is checked against its checksum the first
+    //! time it is mapped, ranges that were verified once are mapped as they are.
+    //!
+    //! @param pack The number of the pack.
+    //! @param offset The offset of the range in the pack.
+    //! @param size The size of the range.
+    //! @param checksum XXH64 of the range.
+    //! @return The range, null if the pack is missing, too short or the range is damaged.
+    //!
+    SharedBuffer::Pointer load(quint64 pack, qint64 offset, qint64 size, quint64 checksum) const
+    {
+        const SharedBuffer::Pointer data = SharedBuffer::map(packPath(m_path, pack), offset, size);
+        if (!data)
+        {
+            qWarning() << "Missing pack" << packPath(m_path, pack);
+            return data;
+        }
+
+        if (!verify(Range { pack, offset, size, checksum }, data->data()))
+        {
+            qWarning() << "Damaged range" << offset << "of pack" << packPath(m_path, pack);
+            return SharedBuffer::Pointer();
+        }
+
+        return data;
+    }
+
+    //! Maps a whole pack, unverified, to copy chunks out of it. Null if the pack is missing.
+    SharedBuffer::Pointer load(quint64 pack) const
+    {
+        const SharedBuffer::Pointer data = SharedBuffer::map(packPath(m_path, pack));
+        if (!data)
+            qWarning() << "Missing pack" << packPath(m_path, pack);
+        return data;
+    }
+
+    //!
+    //! Checks data copied from the store against its checksum, once per range like load.
+    //!
+    //! @param pack The number of the pack the data was put together from.
+    //! @param offset The offset of the first chunk of the data.
+    //! @param size The size of the data.
+    //! @param checksum XXH64 of the data.
+    //! @param data The data.
+    //! @return False if the data does not match its checksum.
+    //!
+    static bool verify(quint64 pack, qint64 offset, qint64 size, quint64 checksum, const char* data)
+    {
+        return verify(Range { pack, offset, size, checksum }, data);
+    }
+
+    //! Returns true if the pack exists.
+    bool contains(quint64 pack) const
+    {
+        return QFile::exists(packPath(m_path, pack));
+    }
+
+    //!
+    //! Deletes the packs that are not referenced. Packs that are deleted while
+    //! a version refers to them make the version fail when it is committed.
+    //!
+    //! @param referenced The numbers of the packs the stored versions refer to.
+    //! @return The number of bytes freed.
+    //!
+    qint64 collect(const QSet<quint64>& referenced) const
+    {
+        qint64 freed = 0;
+
+        const QFileInfoList packs = QDir(m_path).entryInfoList({ "*" + s_packExtension }, QDir::Files);
+        foreach(const QFileInfo& pack, packs)
+        {
+            bool valid = false;
+            const quint64 id = pack.completeBaseName().toULongLong(&valid, 16);
+
+            // packs still mapped can not be deleted on every platform, they are deleted next time
+            if (valid && !referenced.contains(id) && QFile::remove(pack.filePath()))
+                freed += pack.size();
+        }
+
+        return freed;
+    }
+
+    //! Serializes committing versions and collecting packs, so that no pack is collected before its manifest is written.
+    static QMutex& mutex()
+    {
+        static QMutex mutex;
+        return mutex;
+    }
+
+private:
+    //! Boundaries are cut where the upper bits of the rolling hash are zero, about every 128 KiB after the minimum size.
+    static const quint64 s_boundaryMask = 0x1FFFFULL << 47;
+    static const quint64 s_checkSeed = 0x5343454E45ULL;
+
+    //! A stored range, packs are never changed once written so a range is verified once.
+    struct Range
+    {
+        quint64 pack;
+        qint64 offset;
+        qint64 size;
+        quint64 checksum;
+
+        bool operator==(const Range& other) const
+        {
+            return pack == other.pack && offset == other.offset && size == other.size && checksum == other.checksum;
+        }
+
+        friend size_t qHash(const Range& range, size_t seed)
+        {
+            return qHashMulti(seed, range.pack, range.offset, range.size);
+        }
+    };
+
+    const QString m_path;
+
+    //! Hashes the data unless the range was verified before, remembers ranges that match.
+    static bool verify(const Range& range, const char* data)
+    {
+        static QMutex mutex;
+        static QSet<Range> verified;
+
+        {
+            QMutexLocker locker(&mutex);
+            if (verified.contains(range))
+                return true;
+        }
+
+        if (Hash::xxh64(data, range.size) != range.checksum)
+            return false;
+
+        QMutexLocker locker(&mutex);
+        verified.insert(range);
+        return true;
+    }
+
+    static QString packPath(const QString& path, quint64 pack)
+    {
+        return path + QString("%1").arg(pack, 16, 16, QChar('0')) + s_packExtension;
+    }
+
+    //! Returns the length of the chunk starting at data, using a gear rolling hash over the last 64 bytes.
+    static qint64 boundary(const char* data, qint64 size)
+    {
+        if (size <= s_minChunkSize)
+            return size;
+
+        const quint64* gear = gearTable();
+        const qint64 end = qMin(size, s_maxChunkSize);
+        quint64 fingerprint = 0;
+
+        for (qint64 i = s_minChunkSize; i < end; i++)
+        {
+            fingerprint = (fingerprint << 1) + gear[static_cast<uchar>(data[i])];
+            if (!(fingerprint & s_boundaryMask))
+                return i + 1;
+        }
+
+        return end;
+    }
+
+    //! Random values per byte for the rolling hash, derived from the byte so that they are the same everywhere.
+    static const quint64* gearTable()
+    {
+        static const struct Table
+        {
+            quint64 values[256];
+            Table()
+            {
+                for (quint32 i = 0; i < 256; i++)
+                {
+                    const quint32 value = qToLittleEndian(i);
+                    values[i] = Hash::xxh64(&value, sizeof(value), s_checkSeed);
+                }
+            }
+        } table;
+
+        return table.values;
+    }
+};
+
+#endif // CHUNKSTORE_H
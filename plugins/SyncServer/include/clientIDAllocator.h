@@ -0,0 +1,289 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef CLIENTIDALLOCATOR_H
+#define CLIENTIDALLOCATOR_H
+
+#include <QMutex>
+#include <QHash>
+#include <QtAlgorithms>
+#include <cstdint>
+
+//!
+//! Hands out client IDs per MAC address. Free IDs are kept in a two level
+//! bitmap, IDs of disconnected clients stay reserved for their MAC in a LRU
+//! list and are only recycled, oldest first, once no free ID is left. All
+//! operations take constant time under one short lived lock.
+//! Legacy clients get IDs up to s_lastID, clients using the extended header
+//! get IDs above 255 and only fall back to legacy IDs once those are used up,
+//! up to s_lastExtendedID. The IDs in between are never assigned,
+//! they are reserved for the extended header marker and its alias.
+//!
+class ClientIDAllocator
+{
+public:
+    //! Returned to legacy clients if no ID is available.
+    static const int s_invalidID = 255;
+    //! Returned to extended clients if no ID is available.
+    static const int s_invalidExtendedID = 0xFFFF;
+    //! Lowest client ID, 0 is the DataHub.
+    static const int s_firstID = 1;
+    //! Highest client ID of legacy clients.
+    static const int s_lastID = 250;
+    //! Highest client ID of extended clients.
+    static const int s_lastExtendedID = 0xFFFE;
+
+public:
+    ClientIDAllocator()
+    {
+        clear();
+    }
+
+    //! Returns true if the ID can be assigned to a client.
+    static bool isValid(int id)
+    {
+        return id >= s_firstID && id <= s_lastExtendedID && (id <= s_lastID || id > 255);
+    }
+
+    //!
+    //! Returns the ID of the client, reactivating its previous ID if it had one.
+    //!
+    //! @param mac The MAC address of the client.
+    //! @param extended True if the client uses the extended header and accepts 16 bit IDs.
+    //! @return The client ID, s_invalidID or s_invalidExtendedID if all IDs are in use.
+    //!
+    int allocate(int64_t mac, bool extended = false)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        auto iter = m_ids.constFind(mac);
+        if (iter != m_ids.constEnd())
+        {
+            const int id = iter.value();
+            if (extended || id <= s_lastID)
+            {
+                if (!m_active[id])
+                {
+                    unlink(id);
+                    m_active[id] = true;
+                }
+                return id;
+            }
+
+            // a former extended client came back as legacy client, its ID does not fit anymore
+            if (!m_active[id])
+                unlink(id);
+            m_active[id] = false;
+            m_ids.remove(mac);
+            setFree(id);
+        }
+
+        int id = takeFree(extended);
+        if (id < 0)
+        {
+            // recycle the ID of the client that has been gone the longest
+            id = extended && m_oldest[1] != s_none ? m_oldest[1] : m_oldest[0];
+            if (id == s_none)
+                return extended ? s_invalidExtendedID : s_invalidID;
+
+            unlink(id);
+            m_ids.remove(m_macs[id]);
+        }
+
+        m_ids.insert(mac, id);
+        m_macs[id] = mac;
+        m_active[id] = true;
+        return id;
+    }
+
+    //!
+    //! Marks the client as disconnected, its ID stays reserved until it is recycled.
+    //!
+    //! @param id The ID of the client.
+    //! @return False if the ID was not active.
+    //!
+    bool release(int id)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (!isValid(id) || !m_active[id])
+            return false;
+
+        m_active[id] = false;
+        append(id);
+        return true;
+    }
+
+    //! Returns the MAC address of an active client, -1 if the ID is not active.
+    int64_t mac(int id)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (!isValid(id) || !m_active[id])
+            return -1;
+        return m_macs[id];
+    }
+
+    //! Returns the number of assigned IDs, including the reserved ones of disconnected clients.
+    int count()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_ids.size();
+    }
+
+    //! Releases all IDs.
+    void clear()
+    {
+        QMutexLocker locker(&m_mutex);
+
+        m_ids.clear();
+        for (int i = 0; i < s_words; i++)
+            m_free[i] = 0;
+        for (int i = 0; i < s_summaryWords; i++)
+            m_summary[i] = 0;
+        for (int id = 0; id < s_size; id++)
+        {
+            m_macs[id] = -1;
+            m_active[id] = false;
+            m_prev[id] = m_next[id] = s_none;
+        }
+        for (int id = s_firstID; id <= s_lastExtendedID; id++)
+            if (isValid(id))
+                setFree(id);
+        for (int i = 0; i < 2; i++)
+            m_oldest[i] = m_newest[i] = s_none;
+    }
+
+private:
+    //! Number of ID slots.
+    static const int s_size = 65536;
+    //! Number of bitmap words.
+    static const int s_words = s_size / 64;
+    //! Number of summary words, one bit per bitmap word.
+    static const int s_summaryWords = s_words / 64;
+    //! Number of bitmap words holding legacy IDs.
+    static const int s_legacyWords = (s_lastID + 64) / 64;
+    //! Terminates the LRU lists, 0 is never assigned to a client.
+    static const quint16 s_none = 0;
+
+    QMutex m_mutex;
+
+    //! Set bits mark IDs that were never assigned or have been recycled.
+    quint64 m_free[s_words];
+
+    //! Set bits mark the bitmap words with at least one free ID.
+    quint64 m_summary[s_summaryWords];
+
+    //! The ID of every known MAC address.
+    QHash<int64_t, int> m_ids;
+
+    //! The MAC address every assigned ID belongs to.
+    int64_t m_macs[s_size];
+
+    //! Flags of the IDs whose clients are connected.
+    bool m_active[s_size];
+
+    //! LRU lists of the IDs of disconnected clients, oldest first.
+    //! List 0 holds the legacy IDs, list 1 the larger ones.
+    quint16 m_prev[s_size];
+    quint16 m_next[s_size];
+    quint16 m_oldest[2];
+    quint16 m_newest[2];
+
+    //! Returns the LRU list the ID belongs to.
+    static int list(int id) { return id > s_lastID ? 1 : 0; }
+
+    void setFree(int id)
+    {
+        m_free[id >> 6] |= quint64(1) << (id & 63);
+        m_summary[id >> 12] |= quint64(1) << ((id >> 6) & 63);
+    }
+
+    //!
+    //! Takes the lowest free ID from the bitmap, -1 if there is none.
+    //! Extended clients only get a legacy ID once all larger IDs are taken,
+    //! the few legacy IDs are kept for the clients that can't use any other.
+    //!
+    int takeFree(bool extended)
+    {
+        int word = -1;
+        if (extended)
+        {
+            for (int i = 0; i < s_summaryWords && word < 0; i++)
+            {
+                const quint64 summary = i > 0 ? m_summary[i] : m_summary[i] & ~((quint64(1) << s_legacyWords) - 1);
+                if (summary)
+                    word = i * 64 + qCountTrailingZeroBits(summary);
+            }
+        }
+
+        for (int i = 0; i < s_legacyWords && word < 0; i++)
+            if (m_free[i])
+                word = i;
+
+        if (word < 0)
+            return -1;
+
+        const int id = word * 64 + qCountTrailingZeroBits(m_free[word]);
+        m_free[word] &= m_free[word] - 1;
+        if (!m_free[word])
+            m_summary[word >> 6] &= ~(quint64(1) << (word & 63));
+        return id;
+    }
+
+    void append(int id)
+    {
+        const int l = list(id);
+        m_prev[id] = m_newest[l];
+        m_next[id] = s_none;
+        if (m_newest[l] != s_none)
+            m_next[m_newest[l]] = id;
+        else
+            m_oldest[l] = id;
+        m_newest[l] = id;
+    }
+
+    void unlink(int id)
+    {
+        const int l = list(id);
+        if (m_prev[id] != s_none)
+            m_next[m_prev[id]] = m_next[id];
+        else
+            m_oldest[l] = m_next[id];
+
+        if (m_next[id] != s_none)
+            m_prev[m_next[id]] = m_prev[id];
+        else
+            m_newest[l] = m_prev[id];
+
+        m_prev[id] = m_next[id] = s_none;
+    }
+};
+
+#endif // CLIENTIDALLOCATOR_H
@@ -30,6 +30,12 @@ any part thereof, the company/individual will have to contact Filmakademie
 #define COMMANDHANDLER_H
 
 #include "messageReceiver.h"
+#include "livenessTracker.h"
+#include "sceneCatalog.h"
+
+namespace DataHub {
+    class SyncServer;
+}
 
 class CommandHandler : public ZeroMQHandler
 {
@@ -39,28 +45,38 @@ public:
 	//! Constructor
 	//! 
     //! @param core A reference to the DataHub core.
-    //! @param zmqHandler A reference to the broadcastHandler. 
+    //! @param messageSenders The message senders broadcasting status messages, one per header format. 
     //! @param IPAdress The IP adress the CommandHandler shall connect to. 
     //! @param debug Flag determin wether debug informations shall be printed.
     //! @param context The ZMQ context used by the CommandHandler.
     //! 
-    explicit CommandHandler(DataHub::Core* core, MessageSender* messageSender, MessageReceiver* messageReceiver, QString IPAdress = "", bool debug = false, zmq::context_t* context = NULL);
+    explicit CommandHandler(DataHub::Core* core, QList<MessageSender*> messageSenders, MessageReceiver* messageReceiver, QString IPAdress = "", bool debug = false, zmq::context_t* context = NULL);
+    ~CommandHandler();
+
+    //! Returns the client liveness tracker, to be refreshed by the message receivers.
+    LivenessTracker* livenessTracker() { return &m_liveness; }
 
 private:
-    //! The global timeout for tracer clients.
-    static const unsigned int m_pingTimeout = 3;
+    //! The global timeout in ms for tracer clients, refreshed by pings and data traffic.
+    static const qint64 s_pingTimeout = 2500;
 
     //! The local elapsed time in seconds since object has been created.
     unsigned int m_time = 0;
 
-    //! A reference to the message sender. 
-    MessageSender* m_sender;
+    //! References to the message senders. 
+    QList<MessageSender*> m_senders;
+
+    //! True if a sender for clients using the extended header is running.
+    bool m_extendedHeader = false;
 
     //! A reference to the message receiver. 
     MessageReceiver* m_receiver;
 
-    //! The map storing the registered clients ping times.
-    QMap<byte, unsigned int> m_pingMap;
+    //! The registered clients and the time they were last seen.
+    LivenessTracker m_liveness;
+
+    //! Timer advancing the liveness wheel, ticking once per wheel slot.
+    DataHub::TimerThread* m_livenessTimer;
 
 private:
     //! Tracer message types.
@@ -71,13 +87,23 @@ private:
         UNKNOWN = 255
     };
 
-    void updatePingTimeouts(byte clientID, bool isServer);
+    void updatePingTimeouts(quint16 clientID, bool isServer);
     void checkPingTimeouts();
-    void broadcastConnectionStatusUpdate(bool newClient, byte clientID, bool isServer);
-
-    void handlePingMessage(QByteArray& commandMessage, char* responseMessage);
-    void handleFileInfoMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t &multiResponseMessage);
-    void handleIPMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t &multiResponseMessage);
+    void broadcastConnectionStatusUpdate(bool newClient, quint16 clientID, bool isServer);
+    void broadcastMessage(const char* message, size_t size);
+
+    void handlePingMessage(QByteArray& commandMessage, char* responseMessage, quint16 clientID);
+    void handleFileInfoMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t &multiResponseMessage, quint16 clientID, SceneCatalog* sceneCatalog);
+    void handleIPMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t &multiResponseMessage, bool extendedHeader);
+
+    //!
+    //! Handles one request received by the ROUTER socket, every command is answered right away.
+    //!
+    //! @param socket The ROUTER socket the reply is sent through.
+    //! @param request The request including its envelope (identity, empty delimiter, command).
+    //! @param syncServer A reference to the SyncServer plugin.
+    //!
+    void handleRequest(zmq::socket_t& socket, zmq::multipart_t& request, DataHub::SyncServer* syncServer);
 
 public slots:
     //execute operations
@@ -86,6 +112,7 @@ public slots:
 
 private slots:
     void tickTime(int time);
+    void tickLiveness();
 };
 
 #endif // COMMANDHANDLER_H
\ No newline at end of file
@@ -0,0 +1,144 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <QtGlobal>
+#include <QtEndian>
+
+//!
+//! Non-cryptographic hash of binary data, used to checksum and identify
+//! stored scene data. Implements XXH64, results match the reference
+//! implementation on every platform.
+//!
+class Hash
+{
+public:
+    //!
+    //! Hashes the data with XXH64.
+    //!
+    //! @param data The data.
+    //! @param size The size of the data in bytes.
+    //! @param seed The seed of the hash.
+    //! @return The 64 bit hash.
+    //!
+    static quint64 xxh64(const void* data, qint64 size, quint64 seed = 0)
+    {
+        const uchar* p = static_cast<const uchar*>(data);
+        const uchar* const end = p + size;
+        quint64 hash;
+
+        if (size >= 32)
+        {
+            const uchar* const limit = end - 32;
+            quint64 v1 = seed + s_prime1 + s_prime2;
+            quint64 v2 = seed + s_prime2;
+            quint64 v3 = seed;
+            quint64 v4 = seed - s_prime1;
+
+            do
+            {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+                p += 32;
+            } while (p <= limit);
+
+            hash = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+            hash = mergeRound(hash, v1);
+            hash = mergeRound(hash, v2);
+            hash = mergeRound(hash, v3);
+            hash = mergeRound(hash, v4);
+        }
+        else
+            hash = seed + s_prime5;
+
+        hash += static_cast<quint64>(size);
+
+        for (; p + 8 <= end; p += 8)
+        {
+            hash ^= round(0, read64(p));
+            hash = rotate(hash, 27) * s_prime1 + s_prime4;
+        }
+
+        if (p + 4 <= end)
+        {
+            hash ^= static_cast<quint64>(qFromLittleEndian<quint32>(p)) * s_prime1;
+            hash = rotate(hash, 23) * s_prime2 + s_prime3;
+            p += 4;
+        }
+
+        for (; p < end; p++)
+        {
+            hash ^= *p * s_prime5;
+            hash = rotate(hash, 11) * s_prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= s_prime2;
+        hash ^= hash >> 29;
+        hash *= s_prime3;
+        hash ^= hash >> 32;
+
+        return hash;
+    }
+
+private:
+    static const quint64 s_prime1 = 11400714785074694791ULL;
+    static const quint64 s_prime2 = 14029467366897019727ULL;
+    static const quint64 s_prime3 = 1609587929392839161ULL;
+    static const quint64 s_prime4 = 9650029242287828579ULL;
+    static const quint64 s_prime5 = 2870177450012600261ULL;
+
+    static quint64 rotate(quint64 value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static quint64 read64(const uchar* p)
+    {
+        return qFromLittleEndian<quint64>(p);
+    }
+
+    static quint64 round(quint64 accumulator, quint64 input)
+    {
+        accumulator += input * s_prime2;
+        return rotate(accumulator, 31) * s_prime1;
+    }
+
+    static quint64 mergeRound(quint64 accumulator, quint64 value)
+    {
+        accumulator ^= round(0, value);
+        return accumulator * s_prime1 + s_prime4;
+    }
+};
+
+#endif // HASH_H
@@ -0,0 +1,198 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef LIVENESSTRACKER_H
+#define LIVENESSTRACKER_H
+
+#include <QMutex>
+#include <QList>
+#include <QElapsedTimer>
+#include <atomic>
+
+//!
+//! Tracks the liveness of clients with a per client array of last-seen
+//! timestamps and a hashed timing wheel. Refreshing a known client is a
+//! single atomic store, the wheel only looks at clients whose deadline
+//! slot comes up and re-files those that were refreshed in the meantime,
+//! so expiring clients costs O(1) amortized per client and timeout.
+//!
+class LivenessTracker
+{
+public:
+    //! Number of client IDs tracked.
+    static const int s_maxClients = 65536;
+    //! Number of wheel slots, a power of two.
+    static const int s_wheelSize = 64;
+
+public:
+    //! 
+    //! Constructor
+    //! 
+    //! @param timeout Time in ms after which a silent client is considered lost.
+    //! @param resolution Length of a wheel slot in ms.
+    //! 
+    explicit LivenessTracker(qint64 timeout, qint64 resolution = 100) : m_timeout(timeout), m_resolution(resolution)
+    {
+        m_clock.start();
+        m_tick = now() / m_resolution;
+
+        for (int i = 0; i < s_maxClients; i++)
+        {
+            m_lastSeen[i].store(0, std::memory_order_relaxed);
+            m_registered[i].store(false, std::memory_order_relaxed);
+            m_next[i] = s_none;
+        }
+        for (int i = 0; i < s_wheelSize; i++)
+            m_slots[i] = s_none;
+    }
+
+    //!
+    //! Marks the client as alive, may be called from any thread.
+    //!
+    //! @param clientID The ID of the client.
+    //! @return True if the client was not registered before.
+    //!
+    bool touch(int clientID)
+    {
+        if (clientID < 0 || clientID >= s_maxClients)
+            return false;
+
+        const qint64 time = now();
+        m_lastSeen[clientID].store(time, std::memory_order_relaxed);
+
+        if (m_registered[clientID].load(std::memory_order_acquire))
+            return false;
+
+        QMutexLocker locker(&m_mutex);
+        if (m_registered[clientID].load(std::memory_order_relaxed))
+            return false;
+
+        m_registered[clientID].store(true, std::memory_order_release);
+        schedule(clientID, time + m_timeout);
+        return true;
+    }
+
+    //!
+    //! Marks an already registered client as alive without registering unknown ones,
+    //! cheap enough to be called for every received message.
+    //!
+    //! @param clientID The ID of the client.
+    //! @return True if the client is registered.
+    //!
+    bool refresh(int clientID)
+    {
+        if (clientID < 0 || clientID >= s_maxClients || !m_registered[clientID].load(std::memory_order_relaxed))
+            return false;
+
+        m_lastSeen[clientID].store(now(), std::memory_order_relaxed);
+        return true;
+    }
+
+    //! Returns the length of a wheel slot in ms, the interval expire() should be called at.
+    qint64 resolution() const { return m_resolution; }
+
+    //! Returns true if the client is registered and not yet expired.
+    bool isAlive(int clientID) const
+    {
+        return clientID >= 0 && clientID < s_maxClients && m_registered[clientID].load(std::memory_order_acquire);
+    }
+
+    //!
+    //! Advances the wheel up to the current time, to be called periodically.
+    //!
+    //! @return The IDs of all clients that timed out, they are no longer registered.
+    //!
+    QList<int> expire()
+    {
+        QList<int> expired;
+        const qint64 time = now();
+        const qint64 target = time / m_resolution;
+
+        QMutexLocker locker(&m_mutex);
+        for (; m_tick <= target; m_tick++)
+        {
+            const int slot = static_cast<int>(m_tick & (s_wheelSize - 1));
+            int clientID = m_slots[slot];
+            m_slots[slot] = s_none;
+
+            while (clientID != s_none)
+            {
+                const int next = m_next[clientID];
+                const qint64 deadline = m_lastSeen[clientID].load(std::memory_order_relaxed) + m_timeout;
+
+                if (deadline <= time)
+                {
+                    m_next[clientID] = s_none;
+                    m_registered[clientID].store(false, std::memory_order_release);
+                    expired.append(clientID);
+                }
+                else // refreshed since it was filed
+                    schedule(clientID, deadline);
+
+                clientID = next;
+            }
+        }
+
+        return expired;
+    }
+
+private:
+    //! Terminates the slot lists.
+    static const int s_none = -1;
+
+    const qint64 m_timeout;
+    const qint64 m_resolution;
+    QElapsedTimer m_clock;
+    QMutex m_mutex;
+
+    //! Last time in ms each client was seen.
+    std::atomic<qint64> m_lastSeen[s_maxClients];
+    std::atomic<bool> m_registered[s_maxClients];
+
+    //! Intrusive lists of the clients filed into each wheel slot.
+    int m_next[s_maxClients];
+    int m_slots[s_wheelSize];
+
+    //! The next wheel tick to be processed.
+    qint64 m_tick;
+
+    qint64 now() const { return m_clock.elapsed(); }
+
+    //! Files the client into the slot of its deadline, deadlines beyond the wheel go into the last slot and are re-filed later.
+    void schedule(int clientID, qint64 deadline)
+    {
+        const qint64 tick = qBound(m_tick + 1, deadline / m_resolution, m_tick + s_wheelSize - 1);
+        const int slot = static_cast<int>(tick & (s_wheelSize - 1));
+
+        m_next[clientID] = m_slots[slot];
+        m_slots[slot] = clientID;
+    }
+};
+
+#endif // LIVENESSTRACKER_H
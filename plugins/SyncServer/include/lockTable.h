@@ -0,0 +1,200 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef LOCKTABLE_H
+#define LOCKTABLE_H
+
+#include "zeroMQHandler.h"
+#include <QList>
+
+//!
+//! Dense table of scene object locks indexed by (sceneID, objectID).
+//! Every entry stores the owning client and links into an intrusive list
+//! of all locks held by that client, so locking, unlocking and releasing
+//! all locks of a client never search or allocate. The table is split into
+//! pages which are created the first time an object range gets locked.
+//! Owners are 16 bit client IDs, the per client list heads cover all of them.
+//!
+class LockTable
+{
+public:
+    //! Number of objects covered by one page.
+    static const int s_pageSize = 1024;
+    //! Number of client IDs that can own locks.
+    static const int s_maxClients = 65536;
+
+public:
+    LockTable() : m_pages(256 * (65536 / s_pageSize), nullptr), m_heads(s_maxClients, quint32(s_noLock)), m_counts(s_maxClients, 0)
+    {}
+
+    ~LockTable()
+    {
+        qDeleteAll(m_pages);
+    }
+
+    LockTable(const LockTable&) = delete;
+    LockTable& operator=(const LockTable&) = delete;
+
+    //! Number of locks held by the given client.
+    int count(quint16 clientID) const { return m_counts[clientID]; }
+
+    //!
+    //! Locks the object for the given client.
+    //!
+    //! @param clientID The client requesting the lock.
+    //! @param sceneID The scene ID of the object.
+    //! @param objectID The object ID of the object.
+    //! @return False if the client already held the lock.
+    //!
+    bool lock(quint16 clientID, byte sceneID, short objectID)
+    {
+        const quint32 index = toIndex(sceneID, objectID);
+        Entry& entry = this->entry(index);
+
+        if (entry.locked)
+        {
+            if (entry.owner == clientID)
+                return false;
+            // the lock moves to the latest requester
+            unlink(index, entry);
+        }
+
+        link(index, entry, clientID);
+        return true;
+    }
+
+    //!
+    //! Releases the object lock held by the given client.
+    //!
+    //! @param clientID The client releasing the lock.
+    //! @param sceneID The scene ID of the object.
+    //! @param objectID The object ID of the object.
+    //! @return False if the client did not hold the lock.
+    //!
+    bool unlock(quint16 clientID, byte sceneID, short objectID)
+    {
+        const quint32 index = toIndex(sceneID, objectID);
+        Page* page = m_pages[index / s_pageSize];
+
+        if (!page)
+            return false;
+
+        Entry& entry = page->entries[index % s_pageSize];
+        if (!entry.locked || entry.owner != clientID)
+            return false;
+
+        unlink(index, entry);
+        return true;
+    }
+
+    //!
+    //! Releases all locks held by the given client.
+    //!
+    //! @param clientID The client whose locks are released.
+    //! @param released Called with (sceneID, objectID) for every released lock.
+    //!
+    template <typename F>
+    void releaseAll(quint16 clientID, F released)
+    {
+        quint32 index = m_heads[clientID];
+        while (index != s_noLock)
+        {
+            Entry& entry = this->entry(index);
+            const quint32 next = entry.next;
+            entry.locked = false;
+            released(static_cast<byte>(index >> 16), static_cast<short>(index & 0xFFFF));
+            index = next;
+        }
+
+        m_heads[clientID] = s_noLock;
+        m_counts[clientID] = 0;
+    }
+
+private:
+    //! Terminates the per client lock lists.
+    static const quint32 s_noLock = ~quint32(0);
+
+    struct Entry
+    {
+        quint32 prev = s_noLock;
+        quint32 next = s_noLock;
+        quint16 owner = 0;
+        bool locked = false;
+    };
+
+    struct Page
+    {
+        Entry entries[s_pageSize];
+    };
+
+    QList<Page*> m_pages;
+    QList<quint32> m_heads;
+    QList<int> m_counts;
+
+    static quint32 toIndex(byte sceneID, short objectID)
+    {
+        return (static_cast<quint32>(sceneID) << 16) | static_cast<quint16>(objectID);
+    }
+
+    Entry& entry(quint32 index)
+    {
+        Page*& page = m_pages[index / s_pageSize];
+        if (!page)
+            page = new Page();
+        return page->entries[index % s_pageSize];
+    }
+
+    void link(quint32 index, Entry& entry, quint16 clientID)
+    {
+        entry.locked = true;
+        entry.owner = clientID;
+        entry.prev = s_noLock;
+        entry.next = m_heads[clientID];
+        if (entry.next != s_noLock)
+            this->entry(entry.next).prev = index;
+        m_heads[clientID] = index;
+        m_counts[clientID]++;
+    }
+
+    void unlink(quint32 index, Entry& entry)
+    {
+        if (entry.prev != s_noLock)
+            this->entry(entry.prev).next = entry.next;
+        else
+            m_heads[entry.owner] = entry.next;
+
+        if (entry.next != s_noLock)
+            this->entry(entry.next).prev = entry.prev;
+
+        m_counts[entry.owner]--;
+        entry.locked = false;
+    }
+};
+
+#endif // LOCKTABLE_H
@@ -0,0 +1,172 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef MESSAGEQUEUE_H
+#define MESSAGEQUEUE_H
+
+#include <QThread>
+#include <atomic>
+#include <cstdint>
+
+//!
+//! Bounded lock-free multi-producer single-consumer queue.
+//! Every cell carries a sequence number telling producers and the consumer
+//! whether it is free or filled (D. Vyukov's bounded queue), so producers
+//! only contend on one atomic counter and never wait for the consumer
+//! unless the queue is full.
+//!
+template <typename T>
+class MessageQueue
+{
+public:
+    //! 
+    //! Constructor
+    //! 
+    //! @param capacity Maximum number of queued elements, rounded up to a power of two.
+    //! 
+    explicit MessageQueue(size_t capacity = 16384)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        m_mask = size - 1;
+        m_cells = new Cell[size];
+        for (size_t i = 0; i < size; i++)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~MessageQueue()
+    {
+        delete[] m_cells;
+    }
+
+    MessageQueue(const MessageQueue&) = delete;
+    MessageQueue& operator=(const MessageQueue&) = delete;
+
+    //! Maximum number of queued elements.
+    size_t capacity() const { return m_mask + 1; }
+
+    //!
+    //! Tries to append an element, may be called from any thread.
+    //!
+    //! @param value The element, only moved from if it could be queued.
+    //! @return False if the queue is full.
+    //!
+    bool tryPush(T& value)
+    {
+        Cell* cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    //!
+    //! Appends an element, yields the calling thread while the queue is full.
+    //!
+    //! @param value The element to be queued.
+    //!
+    void push(T&& value)
+    {
+        while (!tryPush(value))
+            QThread::yieldCurrentThread();
+    }
+
+    //!
+    //! Takes the oldest element, must only be called from the consumer thread.
+    //!
+    //! @param value Receives the element.
+    //! @return False if the queue is empty.
+    //!
+    bool tryPop(T& value)
+    {
+        Cell* cell = &m_cells[m_dequeuePos & m_mask];
+        const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(m_dequeuePos + 1) < 0)
+            return false;
+
+        value = std::move(cell->value);
+        cell->sequence.store(m_dequeuePos + m_mask + 1, std::memory_order_release);
+        m_dequeuePos++;
+        return true;
+    }
+
+    //! Returns the oldest element without taking it, null if the queue is empty. Must only be called from the consumer thread.
+    const T* front() const
+    {
+        const Cell* cell = &m_cells[m_dequeuePos & m_mask];
+        const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(m_dequeuePos + 1) < 0)
+            return nullptr;
+        return &cell->value;
+    }
+
+    //! Returns true if there is no element to pop, must only be called from the consumer thread.
+    bool isEmpty() const
+    {
+        const size_t sequence = m_cells[m_dequeuePos & m_mask].sequence.load(std::memory_order_acquire);
+        return static_cast<intptr_t>(sequence) - static_cast<intptr_t>(m_dequeuePos + 1) < 0;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell* m_cells;
+    size_t m_mask;
+    //! Producer position, padded to keep producers and consumer on separate cache lines.
+    alignas(64) std::atomic<size_t> m_enqueuePos { 0 };
+    alignas(64) size_t m_dequeuePos = 0;
+};
+
+#endif // MESSAGEQUEUE_H
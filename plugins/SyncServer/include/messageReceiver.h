@@ -31,7 +31,11 @@ any part thereof, the company/individual will have to contact Filmakademie
 
 #include "zeroMQHandler.h"
 #include "messageSender.h"
-#include <QMultiMap>
+#include "parameterHistory.h"
+#include "lockTable.h"
+#include "messageView.h"
+#include "sharedBuffer.h"
+#include "livenessTracker.h"
 
 
 class MessageReceiver : public ZeroMQHandler
@@ -44,57 +48,108 @@ public:
     //! @param core A reference to the DataHub core.
     //! @param IPAdress The IP adress the BroadcastHandler shall connect to. 
     //! @param debug Flag determin wether debug informations shall be printed.
+    //! @param conflateUpdates Flag determin wether parameter updates shall be merged per tick.
     //! @param context The ZMQ context used by the BroadcastHandler.
     //! 
-    explicit MessageReceiver(DataHub::Core* core, QList<MessageSender*> messageSenders, QString IPAdress = "", bool debug = false, bool webSockets = false, bool parameterHistory = true, bool lockHistory = true, zmq::context_t* context = NULL);
+    explicit MessageReceiver(DataHub::Core* core, QList<MessageSender*> messageSenders, QString IPAdress = "", bool debug = false, bool webSockets = false, bool parameterHistory = true, bool lockHistory = true, bool conflateUpdates = false, zmq::context_t* context = NULL);
 
     ~MessageReceiver()
-    {    }
+    {
+        qDeleteAll(m_conflationBuffers);
+    }
 
 private:
     bool m_parameterHistory;
     bool m_lockHistory;
+    bool m_conflateUpdates;
 
-    //! Default mutex used to lock the thread.
-    QMutex m_lockMapMutex;
+    //! Mutex protecting the lock table.
+    QMutex m_lockTableMutex;
 
-    //! The map storing last scene object states. 
-    QMap<QByteArray, QByteArray> m_objectStateMap;
+    //! The latest state of every scene object parameter. 
+    ParameterHistory m_objectStates;
 
-    //! The map storing scene objects lock status. 
-    QMultiMap<byte, QByteArray> m_lockMap;
+    //! The table storing scene objects lock status. 
+    LockTable m_lockTable;
+
+    //! Maximum number of message senders (transports) a receiver forwards to.
+    static const int s_maxSenders = 8;
 
     //! List of references to all message senders.
     QList<MessageSender*> m_senders;
 
+    //! Per client buffers holding the latest parameter updates of the current tick.
+    QHash<quint16, ParameterHistory*> m_conflationBuffers;
+
+    //! Time of the latest buffered parameter update per client.
+    QHash<quint16, byte> m_conflationTimes;
+
+    //! The client that wrote each buffered parameter last, by packed parameter IDs.
+    QHash<quint64, quint16> m_conflationWriters;
+
+    //! Clients with buffered parameter updates.
+    QList<quint16> m_conflatedClients;
+
+    //! Tick counter increased by the core timer.
+    QAtomicInt m_tick;
+
+    //! The tick in which the buffered parameter updates were received.
+    int m_conflationTick = 0;
+
+    //! Client liveness, refreshed by every received message.
+    LivenessTracker* m_liveness = nullptr;
+
 private:
     //! function queing message into all registered senders send ques.
-     inline void QueMessage(zmq::message_t&& message)
+     inline void QueMessage(zmq::message_t&& message, MessageSender::Priority priority = MessageSender::INTERACTIVE)
      {
-         for (int i = 1; i < m_senders.count(); i++) {
-             zmq::message_t msgCopy;
-             msgCopy.copy(message);
-             m_senders[i]->QueMessage(std::move(msgCopy));
+         if (m_senders.count() == 1) {
+             m_senders[0]->QueMessage(std::move(message), priority);
+             return;
          }
 
-         m_senders[0]->QueMessage(std::move(message));
+         // all senders reference the same payload instead of a copy each
+         zmq::message_t shares[s_maxSenders];
+         SharedBuffer::share(std::move(message), shares, m_senders.count());
+         for (int i = 0; i < m_senders.count(); i++)
+             m_senders[i]->QueMessage(std::move(shares[i]), priority);
      }
 
      //! function queing message into all registered senders send ques.
      inline void QueBroadcastMessage(zmq::message_t&& message)
      {
-         for (int i = 1; i < m_senders.count(); i++) {
-             zmq::message_t msgCopy;
-             msgCopy.copy(message);
-             m_senders[i]->QueBroadcastMessage(std::move(msgCopy));
+         if (m_senders.count() == 1) {
+             m_senders[0]->QueBroadcastMessage(std::move(message));
+             return;
          }
 
-         m_senders[0]->QueBroadcastMessage(std::move(message));
+         zmq::message_t shares[s_maxSenders];
+         SharedBuffer::share(std::move(message), shares, m_senders.count());
+         for (int i = 0; i < m_senders.count(); i++)
+             m_senders[i]->QueBroadcastMessage(std::move(shares[i]));
      }
 
+     //! function queing a batch of messages into all registered senders send ques.
+     inline void QueBroadcastMessage(zmq::multipart_t&& messages)
+     {
+         for (int i = 1; i < m_senders.count(); i++)
+             m_senders[i]->QueBroadcastMessage(messages.clone());
+
+         m_senders[0]->QueBroadcastMessage(std::move(messages));
+     }
+
+    //! Merges the message's parameter updates into the sending client's conflation buffer.
+    void ConflateUpdates(const MessageView& message);
+
+    //! Sends one merged PARAMETERUPDATE message per client with buffered updates.
+    void FlushConflatedUpdates();
+
 public:
 
-    void CheckLocks(byte clientID);
+    void CheckLocks(quint16 clientID);
+
+    //! Sets the tracker refreshed by the clients' data traffic, must be called before the thread starts.
+    void SetLivenessTracker(LivenessTracker* liveness) { m_liveness = liveness; }
 
 public slots:
     //!
@@ -102,6 +157,14 @@ public slots:
     //!
     void run();
 
+private slots:
+    //!
+    //! Slot counting the core ticks, used to close the conflation window.
+    //!
+    //! @param time The current tracer time.
+    //!
+    void tickTime(int time);
+
 };
 
 
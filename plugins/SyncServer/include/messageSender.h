@@ -31,6 +31,12 @@ any part thereof, the company/individual will have to contact Filmakademie
 #define MESSAGESENDER_H
 
 #include "zeroMQHandler.h"
+#include "messageQueue.h"
+#include "parameterHistory.h"
+#include <QSemaphore>
+#include <QElapsedTimer>
+#include <memory>
+#include <limits>
 
 
 class MessageSender : public ZeroMQHandler
@@ -38,13 +44,45 @@ class MessageSender : public ZeroMQHandler
     Q_OBJECT
 
 public:
-    explicit MessageSender(DataHub::Core* core, QString IPAdress = "", bool debug = false, bool webSockets = false, zmq::context_t* context = NULL);
+    //! Priority classes of outgoing messages, flushed in this order.
+    enum Priority
+    {
+        CONTROL,     // DataHub sync, lock release and connection status messages
+        INTERACTIVE, // forwarded client messages, kept in one class to preserve their order
+        BULK,        // large snapshots like resent updates, later interactive messages overtake them
+        PRIORITY_COUNT
+    };
+
+public:
+    //! 
+    //! Constructor
+    //! 
+    //! @param core A reference to the DataHub core.
+    //! @param IPAdress The IP adress the MessageSender shall bind to. 
+    //! @param debug Flag determin wether debug informations shall be printed.
+    //! @param webSockets Flag determin wether web sockets shall be used.
+    //! @param batchDivisor Number of core ticks between batched sends, 0 sends every message right away.
+    //! @param extendedHeader Flag determin wether the clients of this sender use the extended message header.
+    //! @param context The ZMQ context used by the MessageSender.
+    //! 
+    explicit MessageSender(DataHub::Core* core, QString IPAdress = "", bool debug = false, bool webSockets = false, int batchDivisor = 0, bool extendedHeader = false, zmq::context_t* context = NULL);
+
+    //! Returns true if the clients of this sender use the extended message header.
+    bool extendedHeader() const { return m_extendedHeader; }
     
-    inline void QueMessage(zmq::message_t&& message)
+    //!
+    //! Function to queue a message for all connected clients.
+    //! Lock-free, the calling thread never waits for the network send.
+    //!
+    //! @param message The message to be sent. 
+    //! @param priority The priority class the message is queued in. 
+    //!
+    inline void QueMessage(zmq::message_t&& message, Priority priority = INTERACTIVE)
     {
-        m_mutex.lock();
-        m_messageList.add(std::move(message));
-        m_mutex.unlock();
+        enqueue(m_lanes[priority], QueuedMessage{ std::move(message), nullptr, m_clock.nsecsElapsed() });
+        // in batching mode the tick wakes the sender
+        if (m_batchDivisor == 0)
+            wakeSender();
     }
 
 	//!
@@ -54,20 +92,132 @@ public:
     //!
     inline void QueBroadcastMessage(zmq::message_t&& message)
     {
-        m_mutex.lock();
-        m_broadcastMessageList.add(std::move(message));
-        m_mutex.unlock();
+        enqueue(m_lanes[CONTROL], QueuedMessage{ std::move(message), nullptr, m_clock.nsecsElapsed() });
+        wakeSender();
+    }
+
+	//!
+    //! Function to broadcast a batch of messages to all connected clients.
+    //! The messages are queued at once and go out in the same multipart message.
+    //!
+    //! @param messages The messages to be broadcasted. 
+    //!
+    inline void QueBroadcastMessage(zmq::multipart_t&& messages)
+    {
+        if (messages.empty())
+            return;
+
+        // one queue element, so batches of concurrent producers can not interleave
+        std::unique_ptr<zmq::multipart_t> batch(new zmq::multipart_t(std::move(messages)));
+        enqueue(m_lanes[CONTROL], QueuedMessage{ zmq::message_t(), std::move(batch), m_clock.nsecsElapsed() });
+        wakeSender();
+    }
+
+    //! Request this process to stop working and wake up the sender thread.
+    void requestStop() override
+    {
+        ZeroMQHandler::requestStop();
+        m_wakeup.release();
     }
 
 private:
-    //! Buffer storing messages for send.
-    zmq::multipart_t m_messageList;
-    //! Buffer storing broadcast messages for send.
-    zmq::multipart_t m_broadcastMessageList;
-    //! Buffer used for broadcasting sync messages.
-    byte m_syncMessage[3] = { m_targetHostID,0,MessageType::EMPTY };
-    //! Buffer used for broadcasting general purpose messages.
-    QByteArray m_broadcastMessage;
+    //! A queued message or batch of messages.
+    struct QueuedMessage
+    {
+        zmq::message_t message;
+        //! The messages of a batch, only allocated for batches to keep the queue cells small.
+        std::unique_ptr<zmq::multipart_t> batch;
+        //! Time the message was queued at in ns.
+        qint64 time = 0;
+    };
+
+    //! Queue and statistics of one priority class.
+    struct Lane
+    {
+        MessageQueue<QueuedMessage> queue;
+        //! Number of bytes sent per flush before the higher classes are checked again.
+        size_t budget = 0;
+        //! Accumulated queue wait times in ns since the last report.
+        qint64 waitTotal = 0;
+        qint64 waitMax = 0;
+        qint64 count = 0;
+    };
+
+    //! Time in ms the idle sender thread sleeps before checking its state again.
+    static const int s_idleTimeout = 100;
+    //! Names of the priority classes for the statistics output.
+    inline static const char* s_priorityNames[PRIORITY_COUNT] = { "control", "interactive", "bulk" };
+    //! Queues storing messages for send, one per priority class.
+    Lane m_lanes[PRIORITY_COUNT];
+    //! Clock used to measure queue wait times.
+    QElapsedTimer m_clock;
+    //! Time of the last statistics report in ns.
+    qint64 m_reportTime = 0;
+    //! True while the sender thread waits for work.
+    std::atomic<bool> m_sleeping { false };
+    //! Wakes the sender thread when there is something to send.
+    QSemaphore m_wakeup;
+    //! Number of core ticks between batched sends, 0 for pass-through.
+    const int m_batchDivisor;
+    //! Core ticks counted since the last batched send.
+    int m_batchTicks = 0;
+    //! Set by the core tick when the next batch is due.
+    std::atomic<bool> m_batchDue { false };
+    //! True if all messages are sent with the extended header, on their own port.
+    const bool m_extendedHeader;
+    //! Number of topics with at least one subscribed client, only used by the sender thread.
+    int m_subscriptions = 0;
+    //! Latest values of the updates sent while a resend snapshot was queued, only used by the sender thread.
+    ParameterHistory m_overtaken;
+
+    //! Queues the message, wakes the sender before waiting for space in a full queue.
+    inline void enqueue(Lane& lane, QueuedMessage&& message)
+    {
+        if (!lane.queue.tryPush(message))
+        {
+            wakeSender();
+            lane.queue.push(std::move(message));
+        }
+    }
+
+    //! Wakes the sender thread if it is waiting for work.
+    inline void wakeSender()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.exchange(false))
+            m_wakeup.release();
+    }
+
+    //! Returns true if there is nothing to send right now.
+    bool isIdle() const;
+
+    //! Sends the queued messages of the class up to its budget as one multipart message,
+    //! the updates of messages queued after snapshotTime are recorded as overtaking the snapshot.
+    void flush(zmq::socket_t& sender, Lane& lane, qint64 snapshotTime = std::numeric_limits<qint64>::max());
+
+    //! Sends all queued messages of the class, merging parameter updates per client, records overtaking updates like flush.
+    void flushBatch(zmq::socket_t& sender, Lane& lane, qint64 snapshotTime = std::numeric_limits<qint64>::max());
+
+    //! Returns the queue time of the oldest bulk message, interactive messages queued later overtake it.
+    qint64 bulkTime() const;
+
+    //! Remembers the latest values of the parameter updates of a message that overtakes a resend snapshot.
+    void recordOvertaken(const zmq::message_t& message);
+
+    //! Sends the overtaking updates again once no snapshot is queued anymore.
+    void resendOvertaken(zmq::socket_t& sender);
+
+    //! Converts the message to the header format of the sender's clients if needed.
+    void convertHeader(zmq::message_t& message) const;
+
+    //! Counts the subscriptions and unsubscriptions the clients sent to the socket.
+    void readSubscriptions(zmq::socket_t& sender);
+
+    //! Collects the wait time statistics of a message taken from the lane.
+    void countWait(Lane& lane, const QueuedMessage& message, qint64 now);
+
+    //! Prints and resets the queue wait statistics of all priority classes.
+    void reportWaitTimes();
 
 public slots:
     //!
@@ -83,6 +233,13 @@ private slots:
     //!
     void createSyncMessage(int time);
 
+    //!
+    //! Slot counting the core ticks to trigger batched sends.
+    //!
+    //! @param time The current tracer time.
+    //!
+    void tickTime(int time);
+
 };
 
 
@@ -0,0 +1,198 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef MESSAGEVIEW_H
+#define MESSAGEVIEW_H
+
+#include "zeroMQHandler.h"
+
+//!
+//! Non-owning, bounds checked view onto a received TRACER message.
+//! The view only references the memory of the underlying zmq message,
+//! so it must not outlive it. Nothing is copied while decoding.
+//! Messages either start with the legacy header (clientID, time, type) or
+//! with the extended header (marker, 16 bit clientID, time, type) negotiated
+//! by clients that need IDs beyond the 8 bit range.
+//!
+class MessageView
+{
+public:
+    //! Size of the legacy message header (clientID, time, message type).
+    static const int s_headerSize = 3;
+
+    //! Size of the extended message header (marker, 16 bit clientID, time, message type).
+    static const int s_extendedHeaderSize = 5;
+
+    //! First byte of an extended header, never assigned as legacy client ID.
+    static const byte s_extendedMarker = 0xFE;
+
+    //! Legacy client ID standing in for clients whose ID does not fit into 8 bits.
+    static const byte s_extendedAliasID = 0xFD;
+
+    //! Size of the header of a single packed parameter update
+    //! (sceneID, objectID, parameterID, parameter type, length).
+    static const int s_parameterHeaderSize = 10;
+
+    //!
+    //! View onto a single parameter update packed into a PARAMETERUPDATE message.
+    //!
+    struct ParameterUpdate
+    {
+        //! Start of the update (sceneID), points into the message.
+        const char* data = nullptr;
+        //! Size of the whole update including its header.
+        int size = 0;
+
+        byte sceneID() const { return static_cast<byte>(data[0]); }
+        short objectID() const { return ZeroMQHandler::CharToShort(data + 1); }
+        short parameterID() const { return ZeroMQHandler::CharToShort(data + 3); }
+        byte parameterType() const { return static_cast<byte>(data[5]); }
+
+        //! The (sceneID, objectID, parameterID) triple packed into the lower 40 bits.
+        quint64 key() const
+        {
+            return (static_cast<quint64>(sceneID()) << 32) |
+                (static_cast<quint64>(static_cast<quint16>(objectID())) << 16) |
+                static_cast<quint64>(static_cast<quint16>(parameterID()));
+        }
+    };
+
+public:
+    //! 
+    //! Constructor
+    //! 
+    //! @param message The received message the view refers to.
+    //! 
+    explicit MessageView(const zmq::message_t& message) :
+        m_data(static_cast<const char*>(message.data())), m_size(static_cast<int>(message.size())),
+        m_headerSize(m_size > 0 && static_cast<byte>(m_data[0]) == s_extendedMarker ? s_extendedHeaderSize : s_headerSize)
+    {}
+
+    //! Returns true if the message holds at least the common header.
+    bool isValid() const { return m_size >= m_headerSize; }
+
+    //! Returns true if the message starts with the extended header.
+    bool isExtended() const { return m_headerSize == s_extendedHeaderSize; }
+
+    //! Size of the message header, the payload starts behind it.
+    int headerSize() const { return m_headerSize; }
+
+    quint16 clientID() const { return isExtended() ? static_cast<quint16>(ZeroMQHandler::CharToShort(m_data + 1)) : static_cast<byte>(m_data[0]); }
+    byte time() const { return static_cast<byte>(m_data[m_headerSize - 2]); }
+    ZeroMQHandler::MessageType type() const { return static_cast<ZeroMQHandler::MessageType>(static_cast<byte>(m_data[m_headerSize - 1])); }
+
+    //! Returns true if the message is large enough to address a scene object (sceneID, objectID).
+    bool hasObject() const { return m_size >= m_headerSize + 3; }
+    //! Returns true if the message is large enough to address an object parameter (sceneID, objectID, parameterID).
+    bool hasParameter() const { return m_size >= m_headerSize + 5; }
+
+    byte sceneID() const { return static_cast<byte>(m_data[m_headerSize]); }
+    short objectID() const { return ZeroMQHandler::CharToShort(m_data + m_headerSize + 1); }
+    short parameterID() const { return ZeroMQHandler::CharToShort(m_data + m_headerSize + 3); }
+
+    //! Returns the lock state of a LOCK message, false if the message is too short.
+    bool lockState() const { return m_size > m_headerSize + 3 && m_data[m_headerSize + 3]; }
+
+    //! Pointer to the object address (sceneID, objectID) of the message.
+    const char* objectData() const { return m_data + m_headerSize; }
+
+    const char* data() const { return m_data; }
+    int size() const { return m_size; }
+
+    //!
+    //! Writes a message header in the legacy or the extended format.
+    //!
+    //! @param header Destination with room for the header.
+    //! @return The size of the written header.
+    //!
+    static int writeHeader(char* header, bool extended, quint16 clientID, byte time, byte type)
+    {
+        if (!extended)
+        {
+            header[0] = static_cast<char>(clientID < s_extendedAliasID ? clientID : s_extendedAliasID);
+            header[1] = static_cast<char>(time);
+            header[2] = static_cast<char>(type);
+            return s_headerSize;
+        }
+
+        header[0] = static_cast<char>(s_extendedMarker);
+        std::memcpy(header + 1, &clientID, 2);
+        header[3] = static_cast<char>(time);
+        header[4] = static_cast<char>(type);
+        return s_extendedHeaderSize;
+    }
+
+    //!
+    //! Returns a copy of the message with its header converted to the given format.
+    //! Legacy receivers see clients with larger IDs as s_extendedAliasID.
+    //!
+    //! @param extended True to convert to the extended header.
+    //! @return The converted message.
+    //!
+    zmq::message_t convert(bool extended) const
+    {
+        const int payloadSize = m_size - m_headerSize;
+        zmq::message_t message(static_cast<size_t>((extended ? s_extendedHeaderSize : s_headerSize) + payloadSize));
+        char* data = static_cast<char*>(message.data());
+        const int headerSize = writeHeader(data, extended, clientID(), time(), static_cast<byte>(type()));
+        std::memcpy(data + headerSize, m_data + m_headerSize, payloadSize);
+        return message;
+    }
+
+    //!
+    //! Decodes the parameter update starting at the given offset and advances
+    //! the offset to the next one. Iteration starts at headerSize() and stops
+    //! at the end of the message or at the first malformed update.
+    //!
+    //! @param offset The offset of the update inside the message.
+    //! @param update The decoded update.
+    //! @return True if a complete update could be decoded.
+    //!
+    bool nextParameterUpdate(int& offset, ParameterUpdate& update) const
+    {
+        if (offset + s_parameterHeaderSize > m_size)
+            return false;
+
+        const int length = ZeroMQHandler::CharToInt(m_data + offset + 6);
+        if (length < s_parameterHeaderSize || length > m_size - offset)
+            return false;
+
+        update.data = m_data + offset;
+        update.size = length;
+        offset += length;
+        return true;
+    }
+
+private:
+    const char* m_data;
+    int m_size;
+    int m_headerSize;
+};
+
+#endif // MESSAGEVIEW_H
@@ -0,0 +1,299 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef PARAMETERHISTORY_H
+#define PARAMETERHISTORY_H
+
+#include "messageView.h"
+#include <QList>
+#include <QByteArray>
+
+//!
+//! Latest-wins store for the last state of every scene object parameter.
+//! Entries are kept in an open addressing hash table keyed by the packed
+//! (sceneID, objectID, parameterID) integer. The serialized updates live
+//! densely packed in a list of bounded size chunks, so an update of an already
+//! known parameter is one probe and an in-place overwrite.
+//! Every chunk starts with a PARAMETERUPDATE message header and is therefore
+//! always a complete, ready to send message. A resend just shares the chunks,
+//! Qt's implicit sharing copies a chunk only if it is patched while in flight.
+//!
+class ParameterHistory
+{
+public:
+    //! Preferred size of a chunk holding the message header and serialized updates.
+    static const int s_chunkSize = 64 * 1024;
+
+public:
+    //! 
+    //! Constructor
+    //! 
+    //! @param capacity Initial number of table slots, rounded up to a power of two.
+    //! @param extendedHeader Flag determin wether the chunks start with the extended message header.
+    //! 
+    explicit ParameterHistory(int capacity = 1024, bool extendedHeader = false) :
+        m_headerSize(extendedHeader ? MessageView::s_extendedHeaderSize : MessageView::s_headerSize)
+    {
+        int bits = 4;
+        while ((1 << bits) < capacity)
+            bits++;
+        resize(bits);
+    }
+
+    //! Number of stored parameters.
+    int count() const { return m_count; }
+
+    //! Returns true if the snapshot messages use the extended header.
+    bool extendedHeader() const { return m_headerSize == MessageView::s_extendedHeaderSize; }
+
+    //! Size of all stored updates in bytes.
+    qsizetype dataSize() const { return m_dataSize; }
+
+    //!
+    //! Stores the given parameter update, replacing the previous value of the parameter.
+    //!
+    //! @param update The update to be stored, usually a view into a received message.
+    //!
+    void update(const MessageView::ParameterUpdate& update)
+    {
+        const quint64 key = update.key();
+        Slot& slot = m_slots[find(key)];
+
+        if (slot.key == key)
+        {
+            if (slot.size == update.size)
+            {
+                std::memcpy(m_chunks[slot.chunk].data() + slot.offset, update.data, update.size);
+                return;
+            }
+            // the value changed its size (e.g. a string parameter), move it to the end
+            erase(slot);
+        }
+        else
+        {
+            if (2 * (m_count + 1) > m_slots.size())
+            {
+                resize(m_bits + 1);
+                insert(key, update);
+                return;
+            }
+            slot.key = key;
+            m_count++;
+        }
+
+        append(slot, update);
+    }
+
+    //!
+    //! Removes the value of a parameter, e.g. because another writer replaced it.
+    //!
+    //! @param key The packed IDs of the parameter, see MessageView::ParameterUpdate::key.
+    //!
+    void remove(quint64 key)
+    {
+        int i = find(key);
+        if (m_slots[i].key != key)
+            return;
+
+        erase(m_slots[i]);
+        m_count--;
+
+        // backward shift deletion, the following keys of the probe sequence move up
+        const int mask = m_slots.size() - 1;
+        for (int j = (i + 1) & mask; m_slots[j].key != s_emptyKey; j = (j + 1) & mask)
+        {
+            if (((j - home(m_slots[j].key)) & mask) >= ((j - i) & mask))
+            {
+                m_slots[i] = m_slots[j];
+                i = j;
+            }
+        }
+        m_slots[i] = Slot{ s_emptyKey, 0, 0, 0 };
+    }
+
+    //! Number of messages a snapshot currently consists of.
+    int chunkCount() const { return m_chunks.size(); }
+
+    //!
+    //! Returns all stored updates as a list of complete PARAMETERUPDATE messages.
+    //! The returned arrays share their data with the history, nothing is serialized.
+    //!
+    //! @param clientID The client ID written into the message headers.
+    //! @param time The time written into the message headers.
+    //! @return The messages holding the stored updates.
+    //!
+    QList<QByteArray> snapshot(quint16 clientID, byte time)
+    {
+        QList<QByteArray> messages;
+        messages.reserve(m_chunks.size());
+
+        char header[MessageView::s_extendedHeaderSize];
+        MessageView::writeHeader(header, extendedHeader(), clientID, time, ZeroMQHandler::MessageType::PARAMETERUPDATE);
+
+        for (QByteArray& chunk : m_chunks)
+        {
+            if (chunk.size() <= m_headerSize)
+                continue;
+
+            if (std::memcmp(chunk.constData(), header, m_headerSize) != 0)
+                std::memcpy(chunk.data(), header, m_headerSize);
+            messages.append(chunk);
+        }
+
+        return messages;
+    }
+
+    //!
+    //! Removes all stored parameters, the table keeps its size.
+    //! The chunks are kept and refilled once the sent snapshots released
+    //! them, so a history flushed every tick doesn't reallocate.
+    //!
+    void clear()
+    {
+        m_slots.fill(Slot{ s_emptyKey, 0, 0, 0 });
+        m_spareChunks.append(m_chunks);
+        if (m_spareChunks.size() > s_maxSpareChunks)
+            m_spareChunks.remove(0, m_spareChunks.size() - s_maxSpareChunks);
+        m_chunks.clear();
+        m_count = 0;
+        m_dataSize = 0;
+    }
+
+private:
+    //! A table slot referencing a serialized update inside a chunk.
+    struct Slot
+    {
+        quint64 key;
+        qint32 chunk;
+        qint32 offset;
+        qint32 size;
+    };
+
+    //! Maximum number of chunks kept for reuse.
+    static const int s_maxSpareChunks = 4;
+
+    //! Marks an empty slot, valid keys only use the lower 40 bits.
+    static const quint64 s_emptyKey = ~quint64(0);
+
+    //! Size of the message header every chunk starts with.
+    const int m_headerSize;
+    QList<Slot> m_slots;
+    QList<QByteArray> m_chunks;
+    //! Chunks of cleared parameters, reused once no snapshot references them.
+    QList<QByteArray> m_spareChunks;
+    int m_bits = 0;
+    int m_count = 0;
+    qsizetype m_dataSize = 0;
+
+    //! Returns the slot the probe sequence of the key starts at.
+    int home(quint64 key) const
+    {
+        // fibonacci hashing spreads the packed IDs over the table
+        return static_cast<int>((key * 0x9E3779B97F4A7C15ull) >> (64 - m_bits));
+    }
+
+    //! Returns the index of the slot holding the key or of the empty slot it would go to.
+    int find(quint64 key) const
+    {
+        const int mask = m_slots.size() - 1;
+        int i = home(key);
+        while (m_slots[i].key != key && m_slots[i].key != s_emptyKey)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void insert(quint64 key, const MessageView::ParameterUpdate& update)
+    {
+        Slot& slot = m_slots[find(key)];
+        slot.key = key;
+        m_count++;
+        append(slot, update);
+    }
+
+    //! Rebuilds the table with 2^bits slots, the stored values are not touched.
+    void resize(int bits)
+    {
+        QList<Slot> previous = std::move(m_slots);
+        m_bits = bits;
+        m_slots = QList<Slot>(1 << bits, Slot{ s_emptyKey, 0, 0, 0 });
+
+        for (const Slot& slot : previous)
+            if (slot.key != s_emptyKey)
+                m_slots[find(slot.key)] = slot;
+    }
+
+    //! Copies the update to the end of the last chunk and references it from the slot.
+    void append(Slot& slot, const MessageView::ParameterUpdate& update)
+    {
+        if (m_chunks.isEmpty() || (m_chunks.last().size() + update.size > s_chunkSize && m_chunks.last().size() > m_headerSize))
+        {
+            // a chunk still shared with a message in flight would be copied, skip it
+            int spare = m_spareChunks.size() - 1;
+            while (spare >= 0 && !m_spareChunks[spare].isDetached())
+                spare--;
+
+            if (spare >= 0)
+            {
+                m_chunks.append(m_spareChunks.takeAt(spare));
+                m_chunks.last().truncate(m_headerSize);
+            }
+            else
+            {
+                char header[MessageView::s_extendedHeaderSize];
+                MessageView::writeHeader(header, extendedHeader(), 0, 0, ZeroMQHandler::MessageType::PARAMETERUPDATE);
+
+                QByteArray chunk;
+                chunk.reserve(qMax(s_chunkSize, m_headerSize + update.size));
+                chunk.append(header, m_headerSize);
+                m_chunks.append(chunk);
+            }
+        }
+
+        QByteArray& chunk = m_chunks.last();
+        slot.chunk = static_cast<qint32>(m_chunks.size() - 1);
+        slot.offset = static_cast<qint32>(chunk.size());
+        slot.size = update.size;
+        chunk.append(update.data, update.size);
+        m_dataSize += update.size;
+    }
+
+    //! Removes the slot's value from its chunk, keeping the chunk densely packed.
+    void erase(const Slot& slot)
+    {
+        m_chunks[slot.chunk].remove(slot.offset, slot.size);
+        m_dataSize -= slot.size;
+
+        // rare path, only taken when a value changes its size or is removed
+        for (Slot& other : m_slots)
+            if (other.key != s_emptyKey && other.chunk == slot.chunk && other.offset > slot.offset)
+                other.offset -= slot.size;
+    }
+};
+
+#endif // PARAMETERHISTORY_H
@@ -0,0 +1,219 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef SCENECATALOG_H
+#define SCENECATALOG_H
+
+#include <QDir>
+#include <QHash>
+#include <QSet>
+#include <QReadWriteLock>
+#include <QFileSystemWatcher>
+#include <QThreadPool>
+#include "sceneDataHandler.h"
+
+//!
+//! In-memory index of the scene versions stored on disk per server.
+//! Directories are scanned once, lookups are then served from memory only.
+//! Scenes the hub writes itself are announced with beginWrite and endWrite, the
+//! changes in between are ignored and the directory is scanned once the scene is
+//! written. Other changes are picked up through a file system watcher and scanned
+//! again on the catalog's own thread, the outdated list is served until then.
+//! Lookups and updates may be called from any thread, the watcher lives in
+//! the thread the catalog was created in and needs its event loop.
+//!
+class SceneCatalog
+{
+public:
+    //! 
+    //! Constructor, indexes all existing scene directories.
+    //! 
+    //! @param path The directory holding one scene directory per server.
+    //! 
+    explicit SceneCatalog(QString path) : m_path(path)
+    {
+        QObject::connect(&m_watcher, &QFileSystemWatcher::directoryChanged, &m_watcher, [this](const QString& dirPath) { changed(dirPath); });
+        m_watcher.addPath(m_path);
+        m_scanner.setMaxThreadCount(1);
+
+        const QStringList serverIDs = QDir(m_path).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        foreach(const QString& serverID, serverIDs)
+        {
+            m_entries.insert(serverID, SceneDataHandler::infoFromDisk(m_path, serverID));
+            m_watched.insert(serverID);
+            m_watcher.addPath(m_path + serverID);
+        }
+    }
+
+    SceneCatalog(const SceneCatalog&) = delete;
+    SceneCatalog& operator=(const SceneCatalog&) = delete;
+
+    //! The directory holding the scene directories.
+    const QString& path() const { return m_path; }
+
+    //!
+    //! Returns the stored versions of every scene part of the server, like SceneDataHandler::infoFromDisk.
+    //! Never touches the disk.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //! @return One name sorted list of files per scene part, empty lists for servers without scene.
+    //!
+    QList<QStringList> info(const QString& serverID) const
+    {
+        QReadLocker locker(&m_lock);
+        return m_entries.value(serverID, QList<QStringList>(SceneDataHandler::s_partCount));
+    }
+
+    //!
+    //! Announces that the hub writes a scene of the server, changes of its directory are ignored until endWrite.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //!
+    void beginWrite(const QString& serverID)
+    {
+        QWriteLocker locker(&m_lock);
+        m_writing[serverID]++;
+    }
+
+    //!
+    //! Ends a write announced with beginWrite and scans the server's directory again.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //!
+    void endWrite(const QString& serverID)
+    {
+        {
+            QWriteLocker locker(&m_lock);
+            if (--m_writing[serverID] <= 0)
+                m_writing.remove(serverID);
+        }
+
+        update(serverID);
+    }
+
+    //!
+    //! Scans the server's scene directory again, on the calling thread.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //! @return The updated scene part lists.
+    //!
+    QList<QStringList> update(const QString& serverID)
+    {
+        const QList<QStringList> info = SceneDataHandler::infoFromDisk(m_path, serverID);
+        const bool exists = QDir(m_path + serverID).exists();
+
+        QWriteLocker locker(&m_lock);
+
+        if (!exists)
+        {
+            // the watcher drops removed directories, a new one has to be registered again
+            m_entries.remove(serverID);
+            m_watched.remove(serverID);
+            return info;
+        }
+
+        m_entries.insert(serverID, info);
+
+        if (!m_watched.contains(serverID))
+        {
+            m_watched.insert(serverID);
+            // the watcher belongs to the creating thread, changes made before it
+            // is registered are caught by scanning once more
+            QMetaObject::invokeMethod(&m_watcher, [this, serverID]()
+            {
+                m_watcher.addPath(m_path + serverID);
+                changed(m_path + serverID);
+            }, Qt::QueuedConnection);
+        }
+
+        return info;
+    }
+
+private:
+    const QString m_path;
+    mutable QReadWriteLock m_lock;
+    QHash<QString, QList<QStringList>> m_entries;
+    QSet<QString> m_watched;
+    //! Number of scenes the hub is writing per server.
+    QHash<QString, int> m_writing;
+    //! Directories queued for scanning, the scene directory itself as empty name.
+    QSet<QString> m_pending;
+    QFileSystemWatcher m_watcher;
+    //! The thread scanning changed directories, destroyed first so that no scan outlives the catalog.
+    QThreadPool m_scanner;
+
+    //! Queues scanning a changed directory, unless the hub is writing to it.
+    void changed(const QString& dirPath)
+    {
+        const QString serverID = dirPath == m_path ? QString() : dirPath.mid(m_path.size());
+
+        {
+            QWriteLocker locker(&m_lock);
+            if (m_writing.contains(serverID) || m_pending.contains(serverID))
+                return;
+            m_pending.insert(serverID);
+        }
+
+        m_scanner.start([this, serverID]()
+        {
+            {
+                QWriteLocker locker(&m_lock);
+                m_pending.remove(serverID);
+            }
+
+            if (serverID.isEmpty())
+                scanDirectories();
+            else
+                update(serverID);
+        });
+    }
+
+    //! Picks up scene directories that were created or removed.
+    void scanDirectories()
+    {
+        const QStringList serverIDs = QDir(m_path).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        const QSet<QString> existing(serverIDs.cbegin(), serverIDs.cend());
+
+        QSet<QString> known;
+        {
+            QReadLocker locker(&m_lock);
+            known = m_watched;
+        }
+
+        foreach(const QString& serverID, existing)
+            if (!known.contains(serverID))
+                update(serverID);
+
+        foreach(const QString& serverID, known)
+            if (!existing.contains(serverID))
+                update(serverID);
+    }
+};
+
+#endif // SCENECATALOG_H
@@ -30,6 +30,8 @@ any part thereof, the company/individual will have to contact Filmakademie
 #ifndef SCENEDADAHANDLER_H
 #define SCENEDADAHANDLER_H
 
+#include "sceneManifest.h"
+
 typedef unsigned char byte;
 
 class SceneDataHandler
@@ -56,53 +58,115 @@ private:
 	inline static const QString materialsString {"_materialsByteData"};
 
 public:
+	//! Number of parts a scene consists of.
+	static const int s_partCount = 7;
+
+	//! Size of the chunks of a chunked scene transfer, requested as "part:offset".
+	static const int s_chunkSize = 1024 * 1024;
+
+	//! Returns the file name suffix of the scene part, parts are ordered like the scene requests.
+	static const QString& partSuffix(int index)
+	{
+		static const QString suffixes[s_partCount] = { headerString, nodesString, parameterObjectsString, objectsString, characterString, texturesString, materialsString };
+		return suffixes[index];
+	}
+
+	//! Returns the index of the scene part the file belongs to, -1 if it is no scene file.
+	static int partIndex(const QString& fileName)
+	{
+		for (int i = 0; i < s_partCount; i++)
+			if (fileName.endsWith(partSuffix(i)))
+				return i;
+		return -1;
+	}
+
+	//!
+	//! Stores the parts of a scene version in the server's chunk store and writes its manifest,
+	//! see SceneManifest. Packs no version refers to any more are deleted afterwards.
+	//!
+	//! @param stamp The time stamp of the version, the name of the manifest.
+	//! @param parts The parts, ordered like partSuffix.
+	//! @return The number of bytes written, -1 if the version could not be stored.
+	//!
+	static qint64 writeVersionToDisk(QString path, QString serverID, QString stamp, const QList<QByteArrayView>& parts)
+	{
+		const ChunkStore store(path + serverID + "/");
+
+		const qint64 written = SceneManifest::write(store.path() + stamp + SceneManifest::s_extension, store, parts);
+		if (written >= 0)
+			SceneManifest::collectGarbage(store);
+
+		return written;
+	}
+
+	//!
+	//! Loads a stored scene part from the version's manifest or, for scenes stored
+	//! by earlier versions, from its own file.
+	//!
+	//! @param version The time stamp of the version.
+	//! @param index The index of the part, see partSuffix.
+	//! @return The part, null if it is missing, empty or damaged.
+	//!
+	static SharedBuffer::Pointer mapPart(QString path, QString serverID, QString version, int index)
+	{
+		const QString filePath = path + serverID + "/" + version;
+
+		const QSharedPointer<SceneManifest> manifest = SceneManifest::open(filePath + SceneManifest::s_extension);
+		if (manifest)
+			return manifest->load(ChunkStore(path + serverID + "/"), index);
+
+		return SharedBuffer::map(filePath + partSuffix(index));
+	}
+
+	//!
+	//! Lists the stored versions of every scene part of the server, sorted by name.
+	//! The directory is scanned once and the files are sorted into their parts.
+	//! Parts stored in a manifest are listed under the name they would have as a file.
+	//!
 	static QList<QStringList> infoFromDisk(QString path, QString serverID)
 	{
-		QList<QStringList> returnvalue;
+		QList<QStringList> returnvalue(s_partCount);
 
-		QDir dir(path + serverID + "/");
-		returnvalue.append(dir.entryList(QStringList() << "*" + headerString, QDir::Files));
-		returnvalue.append(dir.entryList(QStringList() << "*" + nodesString, QDir::Files));
-		returnvalue.append(dir.entryList(QStringList() << "*" + parameterObjectsString, QDir::Files));
-		returnvalue.append(dir.entryList(QStringList() << "*" + objectsString, QDir::Files));
-		returnvalue.append(dir.entryList(QStringList() << "*" + characterString, QDir::Files));
-		returnvalue.append(dir.entryList(QStringList() << "*" + texturesString, QDir::Files));
-		returnvalue.append(dir.entryList(QStringList() << "*" + materialsString, QDir::Files));
+		const QStringList fileNames = QDir(path + serverID + "/").entryList(QDir::Files, QDir::Name);
+		foreach(const QString& fileName, fileNames)
+		{
+			if (fileName.endsWith(SceneManifest::s_extension))
+			{
+				const QString stamp = fileName.chopped(SceneManifest::s_extension.size());
+				for (int i = 0; i < s_partCount; i++)
+					returnvalue[i].append(stamp + partSuffix(i));
+				continue;
+			}
+
+			const int part = partIndex(fileName);
+			if (part >= 0)
+				returnvalue[part].append(fileName);
+		}
 
 		return returnvalue;
 	}
 
-	void writeToDisk(QString path, QString serverID, QString stamp)
+	//! Stores the scene as a new version, returns true if it was stored.
+	bool writeToDisk(QString path, QString serverID, QString stamp)
 	{
-		QDir dir(path + serverID);
-		
-		if (!dir.exists())
-			dir.mkpath(".");
-
-		QString filePath = path + serverID + "/" + stamp;
-
-		writeFile(&headerByteData, filePath + headerString);
-		writeFile(&nodesByteData, filePath + nodesString);
-		writeFile(&parameterObjectsByteData, filePath + parameterObjectsString);
-		writeFile(&objectsByteData, filePath + objectsString);
-		writeFile(&characterByteData, filePath + characterString);
-		writeFile(&texturesByteData, filePath + texturesString);
-		writeFile(&materialsByteData, filePath + materialsString);
+		return writeVersionToDisk(path, serverID, stamp, { headerByteData, nodesByteData, parameterObjectsByteData, objectsByteData, characterByteData, texturesByteData, materialsByteData }) >= 0;
 	}
 
 	void readFromDisk(QString path, QString serverID, int entryNbr)
 	{
-		QList<QStringList> fileNames = infoFromDisk(path, serverID);
-
-		QString filePath = path + serverID + "/";
-		
-		headerByteData = readFile(filePath, fileNames[0], 0);
-		nodesByteData = readFile(filePath, fileNames[1], 0);
-		parameterObjectsByteData = readFile(filePath, fileNames[2], 0);
-		objectsByteData = readFile(filePath, fileNames[3], 0);
-		characterByteData = readFile(filePath, fileNames[4], 0);
-		texturesByteData = readFile(filePath, fileNames[5], 0);
-		materialsByteData = readFile(filePath, fileNames[6], 0);
+		readFromDisk(path, serverID, infoFromDisk(path, serverID));
+	}
+
+	//! Reads the scene files listed in fileNames, as returned by infoFromDisk.
+	void readFromDisk(QString path, QString serverID, const QList<QStringList>& fileNames)
+	{
+		headerByteData = readPart(path, serverID, fileNames[0], 0);
+		nodesByteData = readPart(path, serverID, fileNames[1], 1);
+		parameterObjectsByteData = readPart(path, serverID, fileNames[2], 2);
+		objectsByteData = readPart(path, serverID, fileNames[3], 3);
+		characterByteData = readPart(path, serverID, fileNames[4], 4);
+		texturesByteData = readPart(path, serverID, fileNames[5], 5);
+		materialsByteData = readPart(path, serverID, fileNames[6], 6);
 	}
 
 	bool isEmpty()
@@ -118,16 +182,14 @@ public:
 	}
 
 private:
-	void writeFile(QByteArray* data, QString filePath)
+	//! Reads the first listed version of the part.
+	QByteArray readPart(QString path, QString serverID, QStringList fileNames, int part)
 	{
-		if (!data->isEmpty())
-		{
-			QFile file(filePath);
-			file.open(QIODevice::WriteOnly);
-			file.write(data->data(), data->size());
-			file.flush();
-			file.close();
-		}
+		if (fileNames.isEmpty())
+			return QByteArray();
+
+		const SharedBuffer::Pointer data = mapPart(path, serverID, fileNames[0].chopped(partSuffix(part).size()), part);
+		return data ? QByteArray(data->data(), data->size()) : QByteArray();
 	}
 
 	QByteArray readFile(QString filePath)
@@ -138,19 +200,6 @@ private:
 		}
 		else return QByteArray();
 	}
-
-	QByteArray readFile(QString path, QStringList fileNames, int index)
-	{
-		QByteArray returnvalue;
-		if (!fileNames.isEmpty())
-		{
-			QFile file(path + "/" + fileNames[index]);
-			if (file.exists() && file.open(QIODevice::ReadOnly)) {
-				returnvalue = file.readAll();
-			}
-		}
-		return returnvalue;
-	}
 };
 
 #endif // end SCENEDADAHANDLER_H
\ No newline at end of file
@@ -0,0 +1,467 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef SCENEMANIFEST_H
+#define SCENEMANIFEST_H
+
+#include <QFile>
+#include <QSaveFile>
+#include <QByteArrayView>
+#include <QMutexLocker>
+#include <QDebug>
+#include <cstring>
+#include "chunkStore.h"
+
+//!
+//! Manifest of a stored scene version, listing the chunks every part consists of
+//! and where each chunk is stored in the ChunkStore. A chunk that an earlier version
+//! stored already refers to that version's pack, storing a version only writes the
+//! chunks that changed and the small manifest. Parts are put together when they are
+//! loaded, a part whose chunks lie in one piece is mapped as it is.
+//! The manifest is written once the pack is committed, under a temporary name
+//! that is renamed when it is complete, a version is either complete or absent.
+//!
+//! Layout, all numbers little endian:
+//!   [magic "TSCM"][format version : 4][part count : 4][reserved : 4]
+//!   part count * [size : 8][checksum : 8][chunk count : 8]
+//!   the chunks of all parts in order, see ChunkStore::encodeStored
+//!
+class SceneManifest
+{
+public:
+    //! File name extension of manifests, the name is the time stamp of the scene version.
+    inline static const QString s_extension {".manifest"};
+
+    //! A part of the scene version.
+    struct Part
+    {
+        qint64 size = 0;
+        //! XXH64 of the whole part.
+        quint64 checksum = 0;
+        QList<ChunkStore::Chunk> chunks;
+    };
+
+    //!
+    //! Stores the parts in the chunk store and writes the manifest listing them.
+    //!
+    //! @param filePath The path of the manifest.
+    //! @param store The chunk store of the server's versions.
+    //! @param parts The parts, ordered like the scene requests.
+    //! @return The number of bytes written, -1 if the version could not be stored.
+    //!
+    static qint64 write(const QString& filePath, const ChunkStore& store, const QList<QByteArrayView>& parts)
+    {
+        QSet<ChunkStore::Chunk> stored = storedChunks(store);
+        ChunkStore::Pack pack(store);
+        QList<Part> entries(parts.size());
+        qint64 written = 0;
+
+        for (int i = 0; i < parts.size(); i++)
+        {
+            const qint64 size = storePart(pack, stored, parts[i], entries[i]);
+            if (size < 0)
+                return -1;
+            written += size;
+        }
+
+        return commit(filePath, store, pack, entries) ? written : -1;
+    }
+
+    //!
+    //! Stores the chunks of a part that are not stored yet in the pack of the version,
+    //! chunks stored before are referred to where they are.
+    //!
+    //! @param pack The pack of the version.
+    //! @param stored The stored chunks, see storedChunks. The chunks written are added.
+    //! @param data The part.
+    //! @param part Receives the entry of the part.
+    //! @param known The entry of the part if it is known already, e.g. from a delta transfer
+    //! that verified the part. Its checksum and chunk list are used instead of computing them.
+    //! @return The number of bytes written, -1 if the part could not be written.
+    //!
+    static qint64 storePart(ChunkStore::Pack& pack, QSet<ChunkStore::Chunk>& stored, QByteArrayView data, Part& part, const Part* known = nullptr)
+    {
+        part = Part();
+        part.size = data.size();
+        if (known && known->size == part.size)
+        {
+            part.checksum = known->checksum;
+            part.chunks = known->chunks;
+        }
+        else
+            part.checksum = Hash::xxh64(data.data(), data.size());
+
+        if (part.size == 0)
+            return 0;
+
+        if (part.chunks.isEmpty())
+            part.chunks = ChunkStore::chunks(data.data(), data.size());
+
+        // the new chunks of a part follow each other, a new part is mapped in one piece
+        pack.align();
+        qint64 offset = 0;
+        qint64 written = 0;
+
+        for (ChunkStore::Chunk& chunk : part.chunks)
+        {
+            const QSet<ChunkStore::Chunk>::const_iterator storedChunk = stored.constFind(chunk);
+            if (storedChunk != stored.cend())
+            {
+                chunk.pack = storedChunk->pack;
+                chunk.offset = storedChunk->offset;
+            }
+            else
+            {
+                chunk.offset = pack.append(data.data() + offset, chunk.size);
+                if (chunk.offset < 0)
+                    return -1;
+                chunk.pack = pack.id();
+                stored.insert(chunk);
+                written += chunk.size;
+            }
+            offset += chunk.size;
+        }
+
+        return written;
+    }
+
+    //! Returns the chunks of the versions stored in the chunk store, with their locations.
+    static QSet<ChunkStore::Chunk> storedChunks(const ChunkStore& store)
+    {
+        QSet<ChunkStore::Chunk> chunks;
+        foreach(const QSharedPointer<SceneManifest>& manifest, openAll(store.path()))
+        {
+            foreach(const Part& part, manifest->parts())
+                foreach(const ChunkStore::Chunk& chunk, part.chunks)
+                    chunks.insert(chunk);
+        }
+        return chunks;
+    }
+
+    //!
+    //! Commits the pack of a version and writes the manifest of its parts.
+    //!
+    //! @param filePath The path of the manifest.
+    //! @param store The chunk store of the server's versions.
+    //! @param pack The pack of the version.
+    //! @param parts The parts, ordered like the scene requests.
+    //! @return False if the version could not be stored.
+    //!
+    static bool commit(const QString& filePath, const ChunkStore& store, ChunkStore::Pack& pack, const QList<Part>& parts)
+    {
+        QMutexLocker locker(&ChunkStore::mutex());
+
+        // the packs of earlier versions could have been collected since the chunks were stored
+        QSet<quint64> packs = referencedPacks(parts);
+        packs.remove(pack.id());
+        foreach(const quint64 referenced, packs)
+        {
+            if (!store.contains(referenced))
+            {
+                qWarning() << "Scene manifest" << filePath << "refers to a deleted pack.";
+                return false;
+            }
+        }
+
+        return QDir().mkpath(store.path()) && pack.commit() && save(filePath, parts);
+    }
+
+    //!
+    //! Deletes the packs no stored version refers to, nothing is deleted if a manifest can not be read.
+    //!
+    //! @param store The chunk store of the server's versions.
+    //! @return The number of bytes freed.
+    //!
+    static qint64 collectGarbage(const ChunkStore& store)
+    {
+        QMutexLocker locker(&ChunkStore::mutex());
+
+        bool complete = true;
+        QSet<quint64> referenced;
+        foreach(const QSharedPointer<SceneManifest>& manifest, openAll(store.path(), &complete))
+            referenced.unite(referencedPacks(manifest->parts()));
+
+        return complete ? store.collect(referenced) : 0;
+    }
+
+    //!
+    //! Reads a manifest.
+    //!
+    //! @param filePath The path of the manifest.
+    //! @return The manifest, null if it does not exist or is no valid manifest.
+    //!
+    static QSharedPointer<SceneManifest> open(const QString& filePath)
+    {
+        QFile file(filePath);
+        if (!file.open(QIODevice::ReadOnly))
+            return QSharedPointer<SceneManifest>();
+
+        const QByteArray data = file.readAll();
+        const uchar* p = reinterpret_cast<const uchar*>(data.constData());
+        const uchar* const end = p + data.size();
+
+        if (data.size() < s_headerSize || std::memcmp(p, s_magic, 4) != 0 || qFromLittleEndian<quint32>(p + 4) != s_formatVersion)
+            return invalid(filePath);
+
+        const quint32 partCount = qFromLittleEndian<quint32>(p + 8);
+        p += s_headerSize;
+        if (partCount > (end - p) / s_partEntrySize)
+            return invalid(filePath);
+
+        QSharedPointer<SceneManifest> manifest(new SceneManifest());
+        const uchar* chunk = p + partCount * s_partEntrySize;
+
+        for (quint32 i = 0; i < partCount; i++, p += s_partEntrySize)
+        {
+            Part part;
+            part.size = static_cast<qint64>(qFromLittleEndian<quint64>(p));
+            part.checksum = qFromLittleEndian<quint64>(p + 8);
+            const quint64 chunkCount = qFromLittleEndian<quint64>(p + 16);
+
+            if (chunkCount > static_cast<quint64>((end - chunk) / ChunkStore::s_storedChunkSize))
+                return invalid(filePath);
+
+            part.chunks = ChunkStore::decodeStored(chunk, static_cast<qint64>(chunkCount));
+            chunk += chunkCount * ChunkStore::s_storedChunkSize;
+
+            if (!isComplete(part))
+                return invalid(filePath);
+
+            manifest->m_parts.append(part);
+        }
+
+        return manifest;
+    }
+
+    //!
+    //! Reads the manifests of all versions in a directory.
+    //!
+    //! @param dirPath The directory.
+    //! @param complete Set to false if a manifest could not be read.
+    //! @return The valid manifests.
+    //!
+    static QList<QSharedPointer<SceneManifest>> openAll(const QString& dirPath, bool* complete = nullptr)
+    {
+        QList<QSharedPointer<SceneManifest>> manifests;
+
+        const QStringList fileNames = QDir(dirPath).entryList({ "*" + s_extension }, QDir::Files);
+        foreach(const QString& fileName, fileNames)
+        {
+            const QSharedPointer<SceneManifest> manifest = open(dirPath + fileName);
+            if (manifest)
+                manifests.append(manifest);
+            else if (complete)
+                *complete = false;
+        }
+
+        return manifests;
+    }
+
+    //! The parts of the version.
+    const QList<Part>& parts() const { return m_parts; }
+
+    //!
+    //! Encodes a part for a delta transfer as [size : 8][checksum : 8] followed by its chunk list.
+    //!
+    static QByteArray encode(const Part& part)
+    {
+        QByteArray data(16, 0);
+        qToLittleEndian<quint64>(static_cast<quint64>(part.size), data.data());
+        qToLittleEndian<quint64>(part.checksum, data.data() + 8);
+        ChunkStore::encode(part.chunks, data);
+        return data;
+    }
+
+    //! Decodes a part encoded with encode, returns false if the data is no valid part.
+    static bool decode(const void* data, qint64 size, Part& part)
+    {
+        if (size < 16 || (size - 16) % ChunkStore::s_encodedChunkSize != 0)
+            return false;
+
+        const uchar* p = static_cast<const uchar*>(data);
+        part = Part();
+        part.size = static_cast<qint64>(qFromLittleEndian<quint64>(p));
+        part.checksum = qFromLittleEndian<quint64>(p + 8);
+        part.chunks = ChunkStore::decode(p + 16, (size - 16) / ChunkStore::s_encodedChunkSize);
+
+        return isComplete(part);
+    }
+
+    //!
+    //! Loads a part of the version, see the static load.
+    //!
+    //! @param store The chunk store of the server's versions.
+    //! @param index The index of the part.
+    //! @return The part, null if it is empty, out of range, missing or damaged.
+    //!
+    SharedBuffer::Pointer load(const ChunkStore& store, int index) const
+    {
+        if (index < 0 || index >= m_parts.size())
+            return SharedBuffer::Pointer();
+
+        return load(store, m_parts[index]);
+    }
+
+    //!
+    //! Loads a part. A part whose chunks follow each other in one pack is mapped,
+    //! only the pages of the part. Otherwise the part is copied together from
+    //! the chunks of the versions it shares them with. The part is checked
+    //! against its checksum, a mapped range the first time it is mapped.
+    //!
+    //! @param store The chunk store of the server's versions.
+    //! @param part The part.
+    //! @return The part, null if it is empty, missing or damaged.
+    //!
+    static SharedBuffer::Pointer load(const ChunkStore& store, const Part& part)
+    {
+        if (part.size == 0 || part.chunks.isEmpty())
+            return SharedBuffer::Pointer();
+
+        const ChunkStore::Chunk& first = part.chunks.first();
+        qint64 next = first.offset;
+        bool contiguous = true;
+        foreach(const ChunkStore::Chunk& chunk, part.chunks)
+        {
+            contiguous = contiguous && chunk.pack == first.pack && chunk.offset == next;
+            next += chunk.size;
+        }
+
+        if (contiguous)
+            return store.load(first.pack, first.offset, part.size, part.checksum);
+
+        zmq::message_t data(static_cast<size_t>(part.size));
+        char* target = static_cast<char*>(data.data());
+        QHash<quint64, SharedBuffer::Pointer> packs;
+
+        foreach(const ChunkStore::Chunk& chunk, part.chunks)
+        {
+            SharedBuffer::Pointer& source = packs[chunk.pack];
+            if (!source && !(source = store.load(chunk.pack)))
+                return SharedBuffer::Pointer();
+
+            if (chunk.offset < 0 || chunk.offset > source->size() - chunk.size)
+            {
+                qWarning() << "Chunk beyond the end of its pack in" << store.path();
+                return SharedBuffer::Pointer();
+            }
+
+            std::memcpy(target, source->data() + chunk.offset, static_cast<size_t>(chunk.size));
+            target += chunk.size;
+        }
+
+        if (Hash::xxh64(data.data(), part.size) != part.checksum)
+        {
+            qWarning() << "Damaged chunks of a scene part in" << store.path();
+            return SharedBuffer::Pointer();
+        }
+
+        return SharedBuffer::fromMessage(std::move(data));
+    }
+
+private:
+    inline static const char s_magic[4] = { 'T', 'S', 'C', 'M' };
+    static const quint32 s_formatVersion = 3;
+    static const qint64 s_headerSize = 16;
+    static const qint64 s_partEntrySize = 24;
+
+    QList<Part> m_parts;
+
+    SceneManifest()
+    {
+    }
+
+    //! Writes the manifest, see commit.
+    static bool save(const QString& filePath, const QList<Part>& parts)
+    {
+        qint64 chunkCount = 0;
+        foreach(const Part& part, parts)
+            chunkCount += part.chunks.size();
+
+        QByteArray manifest(s_headerSize + parts.size() * s_partEntrySize, 0);
+        manifest.reserve(manifest.size() + chunkCount * ChunkStore::s_storedChunkSize);
+        uchar* p = reinterpret_cast<uchar*>(manifest.data());
+
+        std::memcpy(p, s_magic, 4);
+        qToLittleEndian<quint32>(s_formatVersion, p + 4);
+        qToLittleEndian<quint32>(static_cast<quint32>(parts.size()), p + 8);
+        p += s_headerSize;
+
+        foreach(const Part& part, parts)
+        {
+            qToLittleEndian<quint64>(static_cast<quint64>(part.size), p);
+            qToLittleEndian<quint64>(part.checksum, p + 8);
+            qToLittleEndian<quint64>(static_cast<quint64>(part.chunks.size()), p + 16);
+            p += s_partEntrySize;
+        }
+
+        foreach(const Part& part, parts)
+            ChunkStore::encodeStored(part.chunks, manifest);
+
+        // commit syncs the manifest to disk and renames it over the target
+        QSaveFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(manifest) != manifest.size() || !file.commit())
+        {
+            qWarning() << "Could not write scene manifest" << filePath << file.errorString();
+            return false;
+        }
+
+        return true;
+    }
+
+    //! Returns true if the chunks cover exactly the size of the part.
+    static bool isComplete(const Part& part)
+    {
+        qint64 size = 0;
+        foreach(const ChunkStore::Chunk& chunk, part.chunks)
+        {
+            if (chunk.size <= 0)
+                return false;
+            size += chunk.size;
+        }
+        return size == part.size;
+    }
+
+    //! Returns the packs the chunks of the parts are stored in.
+    static QSet<quint64> referencedPacks(const QList<Part>& parts)
+    {
+        QSet<quint64> packs;
+        foreach(const Part& part, parts)
+            foreach(const ChunkStore::Chunk& chunk, part.chunks)
+                packs.insert(chunk.pack);
+        return packs;
+    }
+
+    static QSharedPointer<SceneManifest> invalid(const QString& filePath)
+    {
+        qWarning() << "Invalid scene manifest" << filePath;
+        return QSharedPointer<SceneManifest>();
+    }
+};
+
+#endif // SCENEMANIFEST_H
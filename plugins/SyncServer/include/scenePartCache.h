@@ -0,0 +1,294 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef SCENEPARTCACHE_H
+#define SCENEPARTCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QThreadPool>
+#include <list>
+#include "sceneDataHandler.h"
+#include "sharedBuffer.h"
+
+//!
+//! Process-wide cache of the scene parts served to clients, keyed by server,
+//! version and part. Stored versions never change, so entries are only
+//! dropped when the cache exceeds its memory budget, least recently used first.
+//! Parts are mapped on their first request and handed out by reference, a
+//! dropped part stays alive until the last message referencing it was sent.
+//! Their pages are read in on a thread of the cache, not on the requesting one.
+//! Missing and empty parts are cached as well, so repeated requests for them
+//! don't go to the disk again. Parts of a scene that is still received are
+//! pinned outside of the budget until they are on disk. Parts larger than the
+//! whole budget are kept outside of it as well, the few used last.
+//! All methods may be called from any thread.
+//!
+class ScenePartCache
+{
+public:
+    //!
+    //! Constructor
+    //!
+    //! @param path The directory holding one scene directory per server.
+    //! @param budget The maximum size of all cached parts in bytes.
+    //!
+    ScenePartCache(QString path, qint64 budget) : m_path(path), m_budget(budget)
+    {
+        m_loader.setMaxThreadCount(1);
+    }
+
+    ScenePartCache(const ScenePartCache&) = delete;
+    ScenePartCache& operator=(const ScenePartCache&) = delete;
+
+    //!
+    //! Returns the scene part, loading it if it is not cached.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //! @param version The time stamp of the scene version.
+    //! @param index The index of the part, see SceneDataHandler::partSuffix.
+    //! @return The part, null if it does not exist or is empty.
+    //!
+    SharedBuffer::Pointer part(const QString& serverID, const QString& version, int index)
+    {
+        const Key key { serverID, version, index };
+
+        {
+            QMutexLocker locker(&m_mutex);
+            SharedBuffer::Pointer cached;
+            if (find(key, cached))
+                return cached;
+        }
+
+        // mapped without the lock, requests for cached parts don't wait for the disk
+        const SharedBuffer::Pointer part = SceneDataHandler::mapPart(m_path, serverID, version, index);
+
+        SharedBuffer::Pointer cached;
+        {
+            QMutexLocker locker(&m_mutex);
+            cached = store(key, part);
+        }
+
+        // the pages are read in once, in the background, parts larger than the budget are paged in as they are sent
+        if (part && cached == part && entrySize(part) <= m_budget)
+            m_loader.start([part]() { part->load(); });
+
+        return cached;
+    }
+
+    //!
+    //! Adds a part that is not on disk yet, like a scene part that was just received.
+    //! The part is pinned, it is kept regardless of the budget until its version is
+    //! released, so requests for it never wait for the disk. It replaces a cached
+    //! lookup that found nothing.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //! @param version The time stamp of the scene version.
+    //! @param index The index of the part, see SceneDataHandler::partSuffix.
+    //! @param part The part.
+    //!
+    void insert(const QString& serverID, const QString& version, int index, const SharedBuffer::Pointer& part)
+    {
+        if (!part)
+            return;
+
+        const Key key { serverID, version, index };
+
+        QMutexLocker locker(&m_mutex);
+        remove(key);
+        m_pinned.insert(key, part);
+        m_pinnedSize += part->size();
+    }
+
+    //!
+    //! Hands the pinned parts of the version over to the budget, once they are on disk
+    //! or won't be requested anymore. The least recently used parts are dropped if
+    //! the budget is exceeded.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //! @param version The time stamp of the scene version.
+    //!
+    void release(const QString& serverID, const QString& version)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        for (auto pinned = m_pinned.begin(); pinned != m_pinned.end();)
+        {
+            if (pinned.key().serverID != serverID || pinned.key().version != version)
+            {
+                ++pinned;
+                continue;
+            }
+
+            const Key key = pinned.key();
+            const SharedBuffer::Pointer part = pinned.value();
+            m_pinnedSize -= part->size();
+            pinned = m_pinned.erase(pinned);
+            store(key, part);
+        }
+    }
+
+    //! The memory accounted for all cached parts in bytes, pinned parts included.
+    qint64 size()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_size + m_pinnedSize;
+    }
+
+private:
+    struct Key
+    {
+        QString serverID;
+        QString version;
+        int index;
+
+        bool operator==(const Key& other) const
+        {
+            return index == other.index && version == other.version && serverID == other.serverID;
+        }
+    };
+
+    friend size_t qHash(const Key& key, size_t seed)
+    {
+        return qHashMulti(seed, key.serverID, key.version, key.index);
+    }
+
+    struct Entry
+    {
+        Key key;
+        SharedBuffer::Pointer part;
+    };
+
+    //! Memory accounted for every entry besides its part, keeps missing parts from filling the cache without bounds.
+    static const qint64 s_entrySize = 256;
+    //! Number of parts larger than the budget that are kept.
+    static const size_t s_largeParts = 4;
+
+    const QString m_path;
+    const qint64 m_budget;
+    QMutex m_mutex;
+    qint64 m_size = 0;
+    qint64 m_pinnedSize = 0;
+
+    //! Returns the memory accounted for an entry.
+    static qint64 entrySize(const SharedBuffer::Pointer& part)
+    {
+        return s_entrySize + (part ? part->size() : 0);
+    }
+
+    //! Looks up a cached part and marks it as used, must be called locked.
+    bool find(const Key& key, SharedBuffer::Pointer& part)
+    {
+        auto pinned = m_pinned.constFind(key);
+        if (pinned != m_pinned.constEnd())
+        {
+            part = pinned.value();
+            return true;
+        }
+
+        auto entry = m_entries.constFind(key);
+        if (entry != m_entries.constEnd())
+        {
+            m_lru.splice(m_lru.begin(), m_lru, entry.value());
+            part = entry.value()->part;
+            return true;
+        }
+
+        for (auto large = m_large.begin(); large != m_large.end(); ++large)
+        {
+            if (large->key == key)
+            {
+                m_large.splice(m_large.begin(), m_large, large);
+                part = large->part;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //! Adds the part, null for a missing one, unless another thread added it first. Returns the cached one, must be called locked.
+    SharedBuffer::Pointer store(const Key& key, const SharedBuffer::Pointer& part)
+    {
+        SharedBuffer::Pointer cached;
+        if (find(key, cached))
+            return cached;
+
+        // parts larger than the whole budget would drop everything else, they are kept on their own
+        if (entrySize(part) > m_budget)
+        {
+            m_large.push_front(Entry { key, part });
+            if (m_large.size() > s_largeParts)
+                m_large.pop_back();
+            return part;
+        }
+
+        m_lru.push_front(Entry { key, part });
+        m_entries.insert(key, m_lru.begin());
+        m_size += entrySize(part);
+
+        while (m_size > m_budget)
+        {
+            m_size -= entrySize(m_lru.back().part);
+            m_entries.remove(m_lru.back().key);
+            m_lru.pop_back();
+        }
+
+        return part;
+    }
+
+    //! Removes the entry of the key from the cached parts, must be called locked.
+    void remove(const Key& key)
+    {
+        m_large.remove_if([&key](const Entry& large) { return large.key == key; });
+
+        auto entry = m_entries.find(key);
+        if (entry == m_entries.end())
+            return;
+
+        m_size -= entrySize(entry.value()->part);
+        m_lru.erase(entry.value());
+        m_entries.erase(entry);
+    }
+
+    //! Most recently used parts first.
+    std::list<Entry> m_lru;
+    QHash<Key, std::list<Entry>::iterator> m_entries;
+
+    //! Parts of versions that are not on disk yet, outside of the budget.
+    QHash<Key, SharedBuffer::Pointer> m_pinned;
+
+    //! Parts larger than the budget, most recently used first. Mostly mappings, whose pages the system drops as needed.
+    std::list<Entry> m_large;
+
+    //! The thread reading in the pages of newly cached parts.
+    QThreadPool m_loader;
+};
+
+#endif // SCENEPARTCACHE_H
@@ -31,20 +31,37 @@ any part thereof, the company/individual will have to contact Filmakademie
 
 #include "zeroMQHandler.h"
 #include "sceneDataHandler.h"
+#include "sceneCatalog.h"
+#include "scenePartCache.h"
+#include "sceneWriter.h"
+
+class SceneSender;
 
 class SceneReceiver : public ZeroMQHandler
 {
 	Q_OBJECT
 public:
+    //! How the scene is requested from the scene server.
+    enum TransferMode
+    {
+        PARTS,      //!< every part whole
+        CHUNKED,    //!< every part in resumable chunks
+        DELTA       //!< only the chunks missing in the last stored version
+    };
+
 	//! 
 	//! Constructor
 	//! 
     //! @param core A reference to the DataHub core.
     //! @param IPAdress The IP adress the SceneReceiver shall connect to. 
+    //! @param sceneCatalog The index of the stored scene versions, updated after the scene is written.
+    //! @param partCache The cache received parts are added to.
+    //! @param relay The scene service the scene is relayed through while it is received, NULL to serve it once stored.
+    //! @param mode How the scene is requested.
     //! @param debug Flag determin wether debug informations shall be printed.
     //! @param context The ZMQ context used by the SceneReceiver.
     //! 
-    explicit SceneReceiver(DataHub::Core* core, QString IPAdress = "", bool debug = false, zmq::context_t* context = NULL);
+    explicit SceneReceiver(DataHub::Core* core, QString IPAdress = "", SceneCatalog* sceneCatalog = NULL, ScenePartCache* partCache = NULL, SceneSender* relay = NULL, TransferMode mode = PARTS, bool debug = false, zmq::context_t* context = NULL);
     ~SceneReceiver();
 
 private:
@@ -52,14 +69,78 @@ private:
 	//! The list of request the reqester uses to request the packages.
 	//!
 	QList<QString> m_requests;
-    SceneDataHandler *m_sceneData;
-    QByteArray toByteArray(zmq::message_t& message) const
-    {
-        if (message.size() > 0)
-            return QByteArray(static_cast<char*>(message.data()), static_cast<qsizetype>(message.size()));
-        else
-            return QByteArray();
-    }
+    SceneCatalog* m_sceneCatalog;
+    ScenePartCache* m_partCache;
+    SceneSender* m_relay;
+    TransferMode m_mode;
+
+    //! True once a part that is not empty was received.
+    bool m_hasScene = false;
+
+    //! Size of the checksum a .partial file starts with, the received bytes follow it.
+    static const qint64 s_partialHeaderSize = sizeof(quint64);
+
+    //! Number of chunk requests sent ahead of the received chunks.
+    static const int s_maxChunksInFlight = 4;
+    //! Time in ms without any reply after which a chunked or delta transfer is given up.
+    static const int s_replyTimeout = 10000;
+
+    //! Returns true if the process shall stop.
+    bool isStopped();
+
+    //!
+    //! Requests all parts at once and hands each of them over as it arrives.
+    //!
+    //! @return True if the scene was received completely.
+    //!
+    bool receiveParts(zmq::socket_t& socket, SceneWriter& writer, const QString& stamp);
+
+    //!
+    //! Requests the parts in chunks of SceneDataHandler::s_chunkSize with a bounded number in flight.
+    //! Chunks are appended to a .partial file per part, after the checksum of the part they belong
+    //! to. An interrupted transfer continues at the size already received the next time the scene
+    //! is requested, unless the server serves another version of the part by then. Every part is
+    //! checked against its checksum and handed over as its .partial file is complete.
+    //!
+    //! @return True if the scene was received completely.
+    //!
+    bool receiveChunked(zmq::socket_t& socket, SceneWriter& writer, const QString& stamp);
+
+    //!
+    //! Sends the chunk lists of the last stored version and puts the parts together from
+    //! the chunks received and the chunks of the stored version.
+    //!
+    //! @return True if the scene was received completely.
+    //!
+    bool receiveDelta(zmq::socket_t& socket, SceneWriter& writer, const QString& stamp);
+
+    //!
+    //! Hands a received part to the writer and, if the scene is relayed, to the part cache.
+    //!
+    //! @param entry The part entry of a delta transfer, null for parts received whole.
+    //!
+    void addPart(int index, const SharedBuffer::Pointer& part, SceneWriter& writer, const QString& stamp, const SceneManifest::Part* entry = nullptr);
+
+    //! Returns the parts of the last stored version of the scene, empty if there is none.
+    QList<SceneManifest::Part> cachedParts() const;
+
+    //! Maps the chunks of the parts, as ranges of their packs.
+    QHash<ChunkStore::Chunk, SharedBuffer::Pointer> cachedChunks(const QList<SceneManifest::Part>& parts) const;
+
+    //!
+    //! Puts a part together, the received chunks are taken from the reply.
+    //!
+    //! @param known The chunk list sent with the request of the part.
+    //! @param cached The chunks of the last stored version, see cachedChunks.
+    //! @return The part, null if a chunk is missing or the part does not match its checksum.
+    //!
+    static SharedBuffer::Pointer assemble(const SceneManifest::Part& part, zmq::multipart_t& chunks, const QList<ChunkStore::Chunk>& known, const QHash<ChunkStore::Chunk, SharedBuffer::Pointer>& cached);
+
+    //! Returns the path of the file a part is received into in chunked mode.
+    QString partialPath(int index) const;
+
+    //! Returns the paths of the .partial files, removed once the scene is stored.
+    QStringList partialPaths() const;
 
 public slots:
     //execute operations
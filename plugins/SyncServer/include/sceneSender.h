@@ -31,6 +31,26 @@ any part thereof, the company/individual will have to contact Filmakademie
 
 #include "zeroMQHandler.h"
 #include "sceneDataHandler.h"
+#include "sceneCatalog.h"
+#include "scenePartCache.h"
+#include <QElapsedTimer>
+#include <deque>
+#include <map>
+#include <algorithm>
+
+//!
+//! Long-lived scene distribution service. A single ROUTER socket serves the
+//! published scene to any number of clients at once, all of them share the
+//! same memory mapped parts. Replies for a client whose send queue is full
+//! wait in a pending list and are retried, without blocking the others.
+//! Every client downloads the scene that was published when it sent its first
+//! request, a scene published in the meantime is served from its next download on.
+//!
+//! Requests are frames of [empty][request], requests are the names of the parts:
+//!   "<part>"                    the whole part
+//!   "<part>:<offset>"           [total size : 8][offset : 8][checksum : 8][chunk of SceneDataHandler::s_chunkSize at the offset]
+//!   "<part>:delta"[chunk list]  [part entry, see SceneManifest::encode][chunks not in the list, in order]
+//!
 
 class SceneSender : public ZeroMQHandler
 {
@@ -40,22 +60,185 @@ public:
 	//! Constructor
 	//! 
     //! @param core A reference to the DataHub core.
-    //! @param IPAddress The IP address the SceneSender shall connect to. 
+    //! @param IPAddress The IP address the SceneSender binds to. 
+    //! @param sceneCatalog The index of the stored scene versions.
+    //! @param partCache The cache the scene parts are served from.
     //! @param debug Flag determin wether debug informations shall be printed.
     //! @param context The ZMQ context used by the SceneSender.
     //! 
-    explicit SceneSender(DataHub::Core* core, QString serverAddress = "", QString clientAddress = "", bool debug = false, zmq::context_t* context = NULL);
+    explicit SceneSender(DataHub::Core* core, QString IPAddress = "", SceneCatalog* sceneCatalog = NULL, ScenePartCache* partCache = NULL, bool debug = false, zmq::context_t* context = NULL);
     ~SceneSender();
 
+    //!
+    //! Serves the scene stored for the server from now on, may be called from any thread.
+    //! Clients are switched over once they received the last part of their current download.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //!
+    void publishScene(const QString& serverID);
+
+    //!
+    //! Serves a scene while it is still received, may be called from any thread.
+    //! Requests for parts that did not arrive yet wait until they are in the
+    //! part cache or on disk, or until the transfer is completed.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //! @param stamp The time stamp of the received version.
+    //!
+    void publishIncomingScene(const QString& serverID, const QString& stamp);
+
+    //!
+    //! Ends the transfer of a scene published with publishIncomingScene, may be called from any thread.
+    //! Requests still waiting are answered, missing parts with empty messages.
+    //! The parts pinned in the part cache for the transfer are released.
+    //!
+    //! @param serverID The name of the server's scene directory.
+    //! @param stamp The time stamp of the received version.
+    //! @param received False if nothing was received, the stored scene is served again.
+    //!
+    void completeIncomingScene(const QString& serverID, const QString& stamp, bool received);
+
 private:
-	//!
-	//! The list of request the reqester uses to request the packages.
-	//!
-	QMap<std::string, QByteArray*> m_responses;
-    SceneDataHandler *m_sceneData;
-    QString m_clientAddress;
-    bool loadData();
+    //! A reply waiting for room in the send queue of its client.
+    struct PendingReply
+    {
+        std::string identity;
+        zmq::multipart_t reply;
+        //! True if the reply completes the client's download of the scene.
+        bool last;
+        //! The name of the served scene's directory.
+        QString serverID;
+    };
+
+    //! A published scene and the version of each of its parts, empty for missing parts.
+    //! Only used by the service thread.
+    struct Scene
+    {
+        QString serverID;
+        //! The time stamp of a relayed scene, empty for a stored one.
+        QString stamp;
+        QStringList versions;
+        //! The manifests of the served versions, opened on the first delta request.
+        QHash<QString, QSharedPointer<SceneManifest>> manifests;
+        //! The checksums of the parts by index, computed on the first chunk request of parts without manifest.
+        QHash<int, quint64> checksums;
+    };
+
+    //! The scene a client downloads, kept until it was sent the last part.
+    struct Download
+    {
+        QSharedPointer<Scene> scene;
+        //! Time of the client's last request in ms, see m_clock.
+        qint64 lastRequest;
+    };
+
+    //! Time in ms after which replies waiting for full send queues are retried.
+    static const int s_retryInterval = 10;
+    //! Time in ms without requests after which an unfinished download is dropped.
+    static const int s_downloadTimeout = 60000;
+
+    SceneCatalog* m_sceneCatalog;
+    ScenePartCache* m_partCache;
+
+    //! Protects the published scene.
+    QMutex m_sceneMutex;
+    QString m_publishedScene;
+    QString m_publishedStamp;
+    bool m_publishedIncoming = false;
+    bool m_scenePublished = false;
+    //! The relayed scenes that are still received, as server ID and stamp.
+    QSet<QString> m_receivingScenes;
+
+    //! The published scene, downloads that start now are served this one. Only used by the service thread.
+    QSharedPointer<Scene> m_scene;
+    //! The scenes the clients download, by identity. Only used by the service thread.
+    std::map<std::string, Download> m_downloads;
+    //! Copy of m_receivingScenes for the service thread.
+    QSet<QString> m_receiving;
+    //! Clock of the download times.
+    QElapsedTimer m_clock;
+
+    //! Requests waiting for parts of the received scene, oldest first.
+    std::deque<zmq::multipart_t> m_waiting;
+
+    //! Replies waiting for room in their clients' send queues, oldest first.
+    std::deque<PendingReply> m_pending;
+
+    //!
+    //! Picks the stored scene version of every part of the server, the first one by name like SceneDataHandler::readFromDisk.
+    //! All parts of a relayed scene have the version of the stamp.
+    //!
+    QSharedPointer<Scene> loadScene(const QString& serverID, const QString& stamp);
+
+    //! Returns true while the relayed scene is still received.
+    bool isReceiving(const Scene& scene) const;
+
+    //! Returns the scene the client downloads, the published one if it starts a download.
+    Scene& download(const std::string& identity);
+
+    //! Drops the downloads of clients that stopped requesting, e.g. because they disconnected.
+    void expireDownloads();
+
+    //! Returns the key of a relayed scene in m_receivingScenes.
+    static QString receivingKey(const QString& serverID, const QString& stamp);
+
+    //! Returns the index of the scene part the request asks for, -1 if it is no scene part.
+    static int partIndex(const std::string& request);
+
+    //! Returns the scene part asked for by the request, null for missing parts.
+    SharedBuffer::Pointer response(const Scene& scene, const std::string& request);
+
+    //! Answers a request, a whole part or a chunk of it, returns false if it has to wait for a relayed part.
+    bool handleRequest(zmq::socket_t& socket, const zmq::multipart_t& request);
+
+    //! Answers the waiting requests whose parts arrived, keeping the order per client.
+    void handleWaiting(zmq::socket_t& socket);
+
+    //! Returns true if requests of the client are waiting.
+    bool isWaiting(const std::string& identity) const;
+
+    //! Returns the manifest of the served version of the part, null if the version has none.
+    QSharedPointer<SceneManifest> manifest(Scene& scene, int index);
+
+    //!
+    //! Adds the part entry of the manifest and the chunks the client does not have to the reply,
+    //! the chunks are ranges of the mapped part. Parts without a manifest are added whole after
+    //! an empty part entry.
+    //!
+    //! @param data The part, null for a missing or empty one.
+    //! @param known The chunk list of the part the client has, see ChunkStore::encode.
+    //!
+    void addDelta(zmq::multipart_t& reply, const std::string& request, const SharedBuffer::Pointer& data, int index, const QSharedPointer<SceneManifest>& manifest, const zmq::message_t* known);
+
+    //! Returns the XXH64 of the served part, from its manifest or hashed once.
+    quint64 checksum(Scene& scene, int index, const SharedBuffer::Pointer& part);
+
+    //!
+    //! Adds the total size of the part, the offset, the checksum of the part and the chunk at the
+    //! offset to the reply. The checksum tells the client whether the chunks it kept from an
+    //! interrupted transfer belong to the same part. Offsets beyond the end are answered with
+    //! an empty chunk at the end of the part.
+    //!
+    //! @return True if the chunk is the last one of the part.
+    //!
+    bool addChunk(zmq::multipart_t& reply, const std::string& request, Scene& scene, const SharedBuffer::Pointer& part, int index, qint64 offset);
+
+    //! Sends the reply or queues it behind the client's pending replies, last marks the reply completing the scene of the server.
+    void sendReply(zmq::socket_t& socket, const std::string& identity, zmq::multipart_t&& reply, bool last, const QString& serverID);
+
+    //! Retries the pending replies, keeping the order per client.
+    void sendPending(zmq::socket_t& socket);
+
+    //! Sends without waiting, returns false and keeps the reply if the client's send queue is full.
+    static bool trySend(zmq::socket_t& socket, zmq::multipart_t& reply);
 
+signals:
+    //!
+    //! Emitted when a client was sent the last part of the served scene.
+    //!
+    //! @param serverID The name of the served scene's directory.
+    //!
+    void sceneSent(QString serverID);
 
 public slots:
     //execute operations
@@ -63,4 +246,4 @@ public slots:
 
 };
 
-#endif // SCENESENDER_H
\ No newline at end of file
+#endif // SCENESENDER_H
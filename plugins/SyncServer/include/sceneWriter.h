@@ -0,0 +1,173 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef SCENEWRITER_H
+#define SCENEWRITER_H
+
+#include <QThreadPool>
+#include <functional>
+#include "sceneDataHandler.h"
+
+//!
+//! Stores a received scene version part by part. The new chunks of every part are
+//! appended to the version's pack as soon as it is handed over, the pack is committed and the
+//! manifest written once all parts are stored, so the version only appears on
+//! disk when it is complete. Packs no version refers to any more are deleted
+//! afterwards. All writes of all receivers run one after another on a shared
+//! I/O thread, the receivers never wait for the disk.
+//!
+class SceneWriter
+{
+public:
+    //!
+    //! Constructor
+    //!
+    //! @param path The directory holding one scene directory per server.
+    //! @param serverID The name of the server's scene directory.
+    //! @param stamp The time stamp of the version, the name of its manifest.
+    //!
+    SceneWriter(const QString& path, const QString& serverID, const QString& stamp) :
+        m_version(new Version(path + serverID + "/", stamp + SceneManifest::s_extension))
+    {
+        // parts that are never handed over are stored empty
+        for (SceneManifest::Part& part : m_version->parts)
+            part.checksum = Hash::xxh64(nullptr, 0);
+    }
+
+    //!
+    //! Queues storing a part, the part is referenced until it is stored.
+    //!
+    //! @param index The index of the part, see SceneDataHandler::partSuffix.
+    //! @param part The part, null for an empty one.
+    //! @param entry The entry of the part if it is known, its checksum and chunk list are taken over
+    //! instead of being computed again. Null to compute them.
+    //!
+    void addPart(int index, const SharedBuffer::Pointer& part, const SceneManifest::Part* entry = nullptr)
+    {
+        const QSharedPointer<Version> version = m_version;
+        const QSharedPointer<const SceneManifest::Part> known(entry ? new SceneManifest::Part(*entry) : nullptr);
+        pool().start([version, index, part, known]()
+        {
+            if (version->failed)
+                return;
+
+            // the stored versions are read with the first part, on the I/O thread
+            if (!version->indexed)
+            {
+                version->stored = SceneManifest::storedChunks(version->store);
+                version->indexed = true;
+            }
+
+            const qint64 stored = SceneManifest::storePart(version->pack, version->stored, part ? QByteArrayView(part->data(), part->size()) : QByteArrayView(), version->parts[index], known.data());
+            version->failed = stored < 0;
+            version->written += qMax<qint64>(stored, 0);
+        });
+    }
+
+    //!
+    //! Queues writing the manifest after all parts handed over before.
+    //!
+    //! @param done Called on the I/O thread, with true if the version was stored.
+    //!
+    void finish(std::function<void(bool)> done)
+    {
+        const QSharedPointer<Version> version = m_version;
+        pool().start([version, done]()
+        {
+            const bool stored = !version->failed && SceneManifest::commit(version->filePath, version->store, version->pack, version->parts);
+            if (stored)
+            {
+                qInfo() << "Scene" << version->filePath << "stored," << version->written << "bytes of new data.";
+
+                const qint64 freed = SceneManifest::collectGarbage(version->store);
+                if (freed > 0)
+                    qInfo() << freed << "bytes of packs no scene version refers to deleted.";
+            }
+            done(stored);
+        });
+    }
+
+    //!
+    //! Queues dropping the version after all parts handed over before, its pack is discarded.
+    //!
+    //! @param done Called on the I/O thread once the version is dropped.
+    //!
+    void discard(std::function<void()> done)
+    {
+        const QSharedPointer<Version> version = m_version;
+        pool().start([version, done]()
+        {
+            version->failed = true;
+            version->pack.discard();
+            done();
+        });
+    }
+
+    //! Waits until all queued writes are done, before the objects used by their callbacks are deleted.
+    static void waitForDone()
+    {
+        pool().waitForDone();
+    }
+
+private:
+    //! The state of the version, shared by its queued writes and only used on the I/O thread.
+    struct Version
+    {
+        Version(const QString& dirPath, const QString& fileName) :
+            filePath(dirPath + fileName), store(dirPath), pack(store), parts(SceneDataHandler::s_partCount)
+        {
+        }
+
+        QString filePath;
+        ChunkStore store;
+        ChunkStore::Pack pack;
+        //! The stored chunks, see SceneManifest::storedChunks.
+        QSet<ChunkStore::Chunk> stored;
+        bool indexed = false;
+        QList<SceneManifest::Part> parts;
+        qint64 written = 0;
+        bool failed = false;
+    };
+
+    QSharedPointer<Version> m_version;
+
+    //! The I/O thread shared by all writers.
+    static QThreadPool& pool()
+    {
+        static QThreadPool* pool = []()
+        {
+            QThreadPool* pool = new QThreadPool();
+            pool->setMaxThreadCount(1);
+            return pool;
+        }();
+        return *pool;
+    }
+};
+
+#endif // SCENEWRITER_H
@@ -0,0 +1,248 @@
+/*
+-----------------------------------------------------------------------------
+Copyright (c) 2024 Filmakademie Baden-Wuerttemberg, Animationsinstitut R&D Labs
+https://research.animationsinstitut.de/datahub
+https://github.com/FilmakademieRnd/DataHub
+
+Datahub is a development by Filmakademie Baden-Wuerttemberg, Animationsinstitut
+R&D Labs in the scope of the EU funded project MAX-R (101070072) and funding on
+the own behalf of Filmakademie Baden-Wuerttemberg.  Former EU projects Dreamspace
+(610005) and SAUCE (780470) have inspired the DataHub development.
+
+The DataHub is intended for research and development purposes only.
+Commercial use of any kind is not permitted.
+
+There is no support by Filmakademie. Since the Data Hub is available for free,
+Filmakademie shall only be liable for intent and gross negligence; warranty
+is limited to malice. DataHub may under no circumstances be used for racist,
+sexual or any illegal purposes. In all non-commercial productions, scientific
+publications, prototypical non-commercial software tools, etc. using the DataHub
+Filmakademie has to be named as follows: "DataHub by Filmakademie
+Baden-Wuerttemberg, Animationsinstitut (http://research.animationsinstitut.de)".
+
+In case a company or individual would like to use the Data Hub in a commercial
+surrounding or for commercial purposes, software based on these components or
+any part thereof, the company/individual will have to contact Filmakademie
+(research<at>filmakademie.de) for an individual license agreement.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef SHAREDBUFFER_H
+#define SHAREDBUFFER_H
+
+#include <QFile>
+#include <QByteArray>
+#include <QSharedData>
+#include <QExplicitlySharedDataPointer>
+#include <zmq.hpp>
+#include <memory>
+
+//!
+//! Immutable memory referenced by zero-copy messages: a read-only mapping of
+//! a file, a received message, a byte array or a range of another buffer.
+//! Every message created from the buffer holds a reference that ZMQ releases
+//! once the message was sent, so the data is never copied for sending, no
+//! matter how many messages and holders share it.
+//!
+class SharedBuffer : public QSharedData
+{
+public:
+    //! Reference counted pointer to a buffer, null for missing or empty data.
+    typedef QExplicitlySharedDataPointer<SharedBuffer> Pointer;
+
+    //! Messages up to this size are stored inline by ZMQ, copying them is cheaper than sharing.
+    static const size_t s_inlineSize = 32;
+
+public:
+    //!
+    //! Maps the whole file.
+    //!
+    //! @param filePath The path of the file.
+    //! @return The mapping, null if the file is empty or could not be mapped.
+    //!
+    static Pointer map(const QString& filePath)
+    {
+        return map(filePath, 0, -1);
+    }
+
+    //!
+    //! Maps a range of the file, only the pages of the range are mapped.
+    //!
+    //! @param filePath The path of the file.
+    //! @param offset The start of the range.
+    //! @param size The size of the range, -1 for the rest of the file.
+    //! @return The mapping, null if the range is empty, exceeds the file or could not be mapped.
+    //!
+    static Pointer map(const QString& filePath, qint64 offset, qint64 size)
+    {
+        Pointer mapped(new SharedBuffer());
+        mapped->m_file.reset(new QFile(filePath));
+        if (!mapped->m_file->open(QIODevice::ReadOnly))
+            return Pointer();
+
+        const qint64 fileSize = mapped->m_file->size();
+        if (size < 0)
+            size = fileSize - offset;
+        if (size <= 0 || offset < 0 || offset > fileSize - size)
+            return Pointer();
+
+        mapped->m_size = size;
+        mapped->m_data = mapped->m_file->map(offset, size);
+        if (!mapped->m_data)
+            return Pointer();
+
+        mapped->m_begin = reinterpret_cast<const char*>(mapped->m_data);
+        return mapped;
+    }
+
+    //!
+    //! Takes over a received message.
+    //!
+    //! @param message The message, its data is served without copying it.
+    //! @return The buffer, null if the message is empty.
+    //!
+    static Pointer fromMessage(zmq::message_t&& message)
+    {
+        if (message.size() == 0)
+            return Pointer();
+
+        Pointer buffer(new SharedBuffer());
+        buffer->m_message.move(message);
+        buffer->m_begin = static_cast<const char*>(buffer->m_message.data());
+        buffer->m_size = static_cast<qint64>(buffer->m_message.size());
+        return buffer;
+    }
+
+    //!
+    //! Shares the data of a byte array, which must not be modified in place
+    //! afterwards (Qt's copy-on-write takes care of it).
+    //!
+    //! @param data The byte array.
+    //! @return The buffer, null if the array is empty.
+    //!
+    static Pointer fromByteArray(const QByteArray& data)
+    {
+        if (data.isEmpty())
+            return Pointer();
+
+        Pointer buffer(new SharedBuffer());
+        buffer->m_array = data;
+        buffer->m_begin = buffer->m_array.constData();
+        buffer->m_size = buffer->m_array.size();
+        return buffer;
+    }
+
+    //!
+    //! References a range of another buffer, which is kept alive by the range.
+    //!
+    //! @param parent The buffer.
+    //! @param offset The start of the range.
+    //! @param size The size of the range.
+    //! @return The range, null if it is empty or exceeds the buffer.
+    //!
+    static Pointer slice(const Pointer& parent, qint64 offset, qint64 size)
+    {
+        if (!parent || size <= 0 || offset < 0 || offset > parent->size() - size)
+            return Pointer();
+
+        Pointer buffer(new SharedBuffer());
+        buffer->m_parent = parent;
+        buffer->m_begin = parent->data() + offset;
+        buffer->m_size = size;
+        return buffer;
+    }
+
+    ~SharedBuffer()
+    {
+        if (m_data)
+            m_file->unmap(m_data);
+    }
+
+    SharedBuffer(const SharedBuffer&) = delete;
+    SharedBuffer& operator=(const SharedBuffer&) = delete;
+
+    const char* data() const { return m_begin; }
+    qint64 size() const { return m_size; }
+
+    //! Reads every page once, so that later accesses don't wait for the disk.
+    void load() const
+    {
+        volatile char page = 0;
+        for (qint64 offset = 0; offset < m_size; offset += 4096)
+            page = data()[offset];
+        (void)page;
+    }
+
+    //!
+    //! Creates a zero-copy message of a range of the buffer.
+    //!
+    //! @param buffer The buffer, referenced by the message until it is released.
+    //! @param offset The start of the range.
+    //! @param size The size of the range.
+    //! @return The message.
+    //!
+    static zmq::message_t message(const Pointer& buffer, qint64 offset, qint64 size)
+    {
+        buffer->ref.ref();
+        return zmq::message_t(const_cast<char*>(buffer->data() + offset), static_cast<size_t>(size), release, buffer.data());
+    }
+
+    //! Creates a zero-copy message of the whole buffer, an empty message for a null buffer.
+    static zmq::message_t message(const Pointer& buffer)
+    {
+        if (!buffer)
+            return zmq::message_t();
+        return message(buffer, 0, buffer->size());
+    }
+
+    //! Creates a zero-copy message sharing the data of the byte array, see fromByteArray.
+    static zmq::message_t message(const QByteArray& data)
+    {
+        return message(fromByteArray(data));
+    }
+
+    //!
+    //! Takes over the message and creates the given number of messages sharing its data.
+    //! Used to fan out one received message to multiple senders.
+    //!
+    //! @param message The message to be shared.
+    //! @param shares Receives the messages referencing the data.
+    //! @param count The number of messages to be created.
+    //!
+    static void share(zmq::message_t&& message, zmq::message_t* shares, int count)
+    {
+        if (message.size() <= s_inlineSize)
+        {
+            for (int i = 1; i < count; i++)
+                shares[i].copy(message);
+            shares[0].move(message);
+            return;
+        }
+
+        const Pointer buffer = fromMessage(std::move(message));
+        for (int i = 0; i < count; i++)
+            shares[i] = SharedBuffer::message(buffer);
+    }
+
+private:
+    SharedBuffer() = default;
+
+    //! Release hook of the messages, called from a ZMQ thread.
+    static void release(void* data, void* hint)
+    {
+        SharedBuffer* buffer = static_cast<SharedBuffer*>(hint);
+        if (!buffer->ref.deref())
+            delete buffer;
+    }
+
+    //! The mapped file, only allocated for mappings.
+    std::unique_ptr<QFile> m_file;
+    uchar* m_data = nullptr;
+    zmq::message_t m_message;
+    QByteArray m_array;
+    Pointer m_parent;
+    const char* m_begin = nullptr;
+    qint64 m_size = 0;
+};
+
+#endif // SHAREDBUFFER_H
@@ -177,7 +177,7 @@ public slots:
     //! Default thread worker loop.
     virtual void run() = 0;
     //! Request this process to stop working.
-    void requestStop()
+    virtual void requestStop()
     {
        m_mutex.lock();
        m_stop = true;
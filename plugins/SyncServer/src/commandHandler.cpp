@@ -35,83 +35,107 @@ any part thereof, the company/individual will have to contact Filmakademie
 
 using namespace DataHub;
 
-CommandHandler::CommandHandler(Core* core, MessageSender* messageSender, MessageReceiver *messageReceiver, QString IPAdress, bool debug, zmq::context_t* context) 
-	: ZeroMQHandler(core, IPAdress, debug, false, context), m_sender(messageSender), m_receiver(messageReceiver)
+CommandHandler::CommandHandler(Core* core, QList<MessageSender*> messageSenders, MessageReceiver *messageReceiver, QString IPAdress, bool debug, zmq::context_t* context) 
+	: ZeroMQHandler(core, IPAdress, debug, false, context), m_senders(messageSenders), m_receiver(messageReceiver), m_liveness(s_pingTimeout)
 {
+	foreach(const MessageSender* sender, m_senders)
+		m_extendedHeader |= sender->extendedHeader();
+
 	connect(core, SIGNAL(tickSecond(int)), this, SLOT(tickTime(int)), Qt::DirectConnection);
 	connect(core->getPlugin<SyncServer*>(), SIGNAL(broadcastSceneReceived(QString)), this, SLOT(broadcastSceneReceived(QString)), Qt::DirectConnection);
+
+	// the liveness wheel advances on its own timer, one tick per wheel slot
+	m_livenessTimer = new TimerThread(m_liveness.resolution(), false, this);
+	connect(m_livenessTimer, SIGNAL(tick()), this, SLOT(tickLiveness()), Qt::DirectConnection);
+	m_livenessTimer->start();
+}
+
+CommandHandler::~CommandHandler()
+{
+	m_livenessTimer->quit();
+	m_livenessTimer->wait();
 }
 
 void CommandHandler::tickTime(int time)
 {
-	// increase local time for controlling client timeouts
+	// increase local time for the console output
 	m_time++;
 	std::cout << "\r" << "Time " << QDateTime::fromSecsSinceEpoch(m_time).toString("mm:ss").toStdString() << " ";
+}
 
+void CommandHandler::tickLiveness()
+{
+	// called once per wheel slot, client timeouts have sub-second resolution
 	checkPingTimeouts();
 }
 
-void CommandHandler::updatePingTimeouts(byte clientID, bool isServer)
+void CommandHandler::updatePingTimeouts(quint16 clientID, bool isServer)
 {
-	if (clientID > 250)
+	if (!ClientIDAllocator::isValid(clientID))
 		return;
 
 	//update ping timeout
-	m_mutex.lock();
-	auto client = m_pingMap.find(clientID);
-	if (client != m_pingMap.end())
-	{
-		client.value() = m_time;
-	}
-	else
+	if (m_liveness.touch(clientID))
 	{
-		m_pingMap.insert(clientID, m_time);
-		
 		broadcastConnectionStatusUpdate(true, clientID, isServer);
 
 		qInfo() << "New client registered:" << clientID;
 	}
-	m_mutex.unlock();
 }
 
 void CommandHandler::checkPingTimeouts()
 {
 	//check if ping timed out for any client
+	const QList<int> lostClients = m_liveness.expire();
+
+	if (lostClients.isEmpty())
+		return;
+
 	m_mutex.lock();
-	foreach(const unsigned int time, m_pingMap.values())
+	foreach(const int lostClient, lostClients)
 	{
-		if (m_time - time > m_pingTimeout)
-		{
-			//connection to client lost
-			byte clientID = m_pingMap.key(time);
-			m_pingMap.remove(clientID);
+		//connection to client lost
+		const quint16 clientID = static_cast<quint16>(lostClient);
 
-			broadcastConnectionStatusUpdate(false, clientID, false);
+		broadcastConnectionStatusUpdate(false, clientID, false);
 
-			qInfo().nospace() << "Lost connection to client: " << clientID;
+		qInfo().nospace() << "Lost connection to client: " << clientID;
 
-			SyncServer::removeClient(clientID);
+		SyncServer::removeClient(clientID);
 
-			//check if client had lock
-			m_receiver->CheckLocks(clientID);
-		}
+		//check if client had lock
+		m_receiver->CheckLocks(clientID);
 	}
 	m_mutex.unlock();
 }
 
-void CommandHandler::broadcastConnectionStatusUpdate(bool newClient, byte clientID, bool isServer)
+void CommandHandler::broadcastConnectionStatusUpdate(bool newClient, quint16 clientID, bool isServer)
 {
-	char newMessage[7];
+	char newMessage[9];
 
 	newMessage[0] = m_targetHostID;
 	newMessage[1] = m_core->m_time;
 	newMessage[2] = ZeroMQHandler::MessageType::DATAHUB;
 	newMessage[3] = CommandHandler::MessageType::CONNECTIONSTATUS;
 	newMessage[4] = newClient; // client new or lost
-	newMessage[5] = clientID; // new client ID
+	newMessage[5] = clientID <= ClientIDAllocator::s_lastID ? clientID : MessageView::s_extendedAliasID; // new client ID
 	newMessage[6] = isServer; // is the new client a server
 
-	m_sender->QueBroadcastMessage(std::move(zmq::message_t(newMessage, 7)));
+	// IDs beyond the legacy range are appended in full
+	if (clientID <= ClientIDAllocator::s_lastID)
+		broadcastMessage(newMessage, 7);
+	else
+	{
+		std::memcpy(newMessage + 7, &clientID, 2);
+		broadcastMessage(newMessage, 9);
+	}
+}
+
+void CommandHandler::broadcastMessage(const char* message, size_t size)
+{
+	// every sender converts the DataHub header to its clients' format itself
+	foreach(MessageSender* sender, m_senders)
+		sender->QueBroadcastMessage(zmq::message_t(message, size));
 }
 
 void CommandHandler::broadcastSceneReceived(QString senderIP)
@@ -126,12 +150,12 @@ void CommandHandler::broadcastSceneReceived(QString senderIP)
 	newMessage[3] = CommandHandler::MessageType::SCENERECEIVED;
 	newMessage[4] = senderIP.section('.', 3, 3).toInt();
 
-	m_sender->QueBroadcastMessage(std::move(zmq::message_t(newMessage, 5)));
+	broadcastMessage(newMessage, 5);
 
 	m_mutex.unlock();
 }
 
-void CommandHandler::handlePingMessage(QByteArray& commandMessage, char* responseMessage)
+void CommandHandler::handlePingMessage(QByteArray& commandMessage, char* responseMessage, quint16 clientID)
 {
 	byte msgServer = 0;
 
@@ -140,40 +164,110 @@ void CommandHandler::handlePingMessage(QByteArray& commandMessage, char* respons
 
 	responseMessage[2] = CommandHandler::MessageType::PING;
 
-	QThread::msleep(10);
-
-	updatePingTimeouts(commandMessage[0], msgServer);
+	updatePingTimeouts(clientID, msgServer);
 }
 
-void CommandHandler::handleFileInfoMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t& multiResponseMessage)
+void CommandHandler::handleFileInfoMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t& multiResponseMessage, quint16 clientID, SceneCatalog* sceneCatalog)
 {
 	responseMessage[2] = CommandHandler::MessageType::FILEINFO;
-	QList<QStringList> fileInfo = SceneDataHandler::infoFromDisk("./", m_IPadress.section('.', 0, 2) + "." + QString::number(commandMessage[0]));
+	QList<QStringList> fileInfo = sceneCatalog->info(m_IPadress.section('.', 0, 2) + "." + QString::number(clientID));
 	multiResponseMessage.add(zmq::message_t(responseMessage, 3));
 	
 	foreach(const QString & scenePartVersion, fileInfo[0])
 		multiResponseMessage.addstr(scenePartVersion.toStdString());
 }
 
-void CommandHandler::handleIPMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t& multiResponseMessage)
+void CommandHandler::handleIPMessage(QByteArray& commandMessage, char* responseMessage, zmq::multipart_t& multiResponseMessage, bool extendedHeader)
 {
 	responseMessage[2] = CommandHandler::MessageType::ID;
 	
-	byte cID =  SyncServer::addClient(SyncServer::macToInt(commandMessage[3], commandMessage[4], commandMessage[5], commandMessage[6], commandMessage[7], commandMessage[8]));
+	// a client asking with the extended header gets a 16 bit ID if the extended sender is running,
+	// the size of the ID frame tells the client which header it has to use
+	const bool extendedID = extendedHeader && m_extendedHeader;
+	const quint16 cID = SyncServer::addClient(SyncServer::macToInt(commandMessage[3], commandMessage[4], commandMessage[5], commandMessage[6], commandMessage[7], commandMessage[8]), extendedID);
 	qDebug().nospace() << "Client: " << cID << " checked" << " with MAC: " << QByteArray(commandMessage.sliced(3), 6).toHex(':');
 	
 	multiResponseMessage.add(zmq::message_t(responseMessage, 3));
-	multiResponseMessage.add(zmq::message_t(&cID, 1));
+	if (extendedID)
+		multiResponseMessage.add(zmq::message_t(&cID, 2));
+	else
+	{
+		const byte legacyID = static_cast<byte>(cID);
+		multiResponseMessage.add(zmq::message_t(&legacyID, 1));
+	}
+}
+
+void CommandHandler::handleRequest(zmq::socket_t& socket, zmq::multipart_t& request, SyncServer* syncServer)
+{
+	// ROUTER envelope of a REQ client: identity, empty delimiter, command
+	if (request.size() < 3)
+		return;
+
+	zmq::multipart_t reply;
+	reply.add(request.pop()); // identity
+	reply.add(request.pop()); // delimiter
+	zmq::message_t message = request.pop();
+
+	char responseMsg[3];
+	responseMsg[0] = m_targetHostID;
+	responseMsg[1] = m_core->m_time;
+	responseMsg[2] = CommandHandler::MessageType::UNKNOWN;
+
+	const MessageView header(message);
+
+	if (!header.isValid())
+	{
+		reply.addmem(responseMsg, 3);
+		reply.send(socket);
+		return;
+	}
+
+	// the handlers address the payload behind a legacy sized header, the client ID is decoded here
+	const int skip = header.headerSize() - MessageView::s_headerSize;
+	QByteArray msgArray = QByteArray((char*)message.data() + skip, static_cast<int>(message.size()) - skip);
+
+	quint16 clientID = header.clientID();
+	byte msgTime = header.time();
+	byte msgType = header.type();
+
+	switch (msgType)
+	{
+		case CommandHandler::MessageType::PING:
+			handlePingMessage(msgArray, responseMsg, clientID);
+			reply.addmem(responseMsg, 3);
+			break;
+		case CommandHandler::MessageType::REQUESTSCENE:
+			syncServer->requestScene(clientID);
+			reply.addmem(responseMsg, 3);
+			break;
+		case CommandHandler::MessageType::SENDSCENE:
+			syncServer->sendScene(clientID);
+			reply.addmem(responseMsg, 3);
+			break;
+		case CommandHandler::MessageType::FILEINFO:
+			// served from the in-memory catalog, no disk access on this thread
+			handleFileInfoMessage(msgArray, responseMsg, reply, clientID, syncServer->sceneCatalog());
+			break;
+		case CommandHandler::MessageType::ID:
+			handleIPMessage(msgArray, responseMsg, reply, header.isExtended());
+			break;
+		default:
+			// always answer, a REQ client would wait forever otherwise
+			reply.addmem(responseMsg, 3);
+			break;
+	}
+
+	reply.send(socket);
 }
 
 void CommandHandler::run()
 {
-	zmq::socket_t socket(*m_context, ZMQ_REP);
-	//socket.setsockopt(ZMQ_CONNECT_TIMEOUT, 2000);
-	socket.setsockopt(ZMQ_RCVTIMEO, 100);
+	zmq::socket_t socket(*m_context, ZMQ_ROUTER);
 	QString address = "tcp://" + m_IPadress + ":5558";
 	socket.bind(address.toLatin1().data());
 
+	zmq::pollitem_t item = { static_cast<void*>(socket), 0, ZMQ_POLLIN, 0 };
+
 	SyncServer* syncServer = m_core->getPlugin<SyncServer*>();
 
 	startInfo(address);
@@ -184,63 +278,21 @@ void CommandHandler::run()
 		bool stop = m_stop;
 		m_mutex.unlock();
 
-		zmq::message_t message;
-		socket.recv(&message);
+		zmq::poll(&item, 1, std::chrono::milliseconds(100));
 
-		if (message.size() > 0)
+		if (item.revents & ZMQ_POLLIN)
 		{
-			char responseMsg[3];
-			responseMsg[0] = m_targetHostID;
-			responseMsg[1] = m_core->m_time;
-			responseMsg[2] = CommandHandler::MessageType::UNKNOWN;
-
-			QByteArray msgArray = QByteArray((char*)message.data(), static_cast<int>(message.size()));
-
-			byte clientID = msgArray[0];
-			byte msgTime = msgArray[1];
-			byte msgType = msgArray[2];
-
-			switch (msgType)
+			zmq::multipart_t request;
+			while (request.recv(socket, ZMQ_DONTWAIT))
 			{
-				case CommandHandler::MessageType::PING:
-				{
-					handlePingMessage(msgArray, responseMsg);
-					socket.send(responseMsg, 3);
-
-					break;
-				}
-				case CommandHandler::MessageType::REQUESTSCENE:
-					syncServer->requestScene(clientID);
-					socket.send(responseMsg, 3);
-					break;
-				case CommandHandler::MessageType::SENDSCENE:
-					syncServer->sendScene(m_IPadress, clientID);
-					socket.send(responseMsg, 3);
-					break;
-				case CommandHandler::MessageType::FILEINFO:
-				{
-					zmq::multipart_t fileInfoReply;
-					handleFileInfoMessage(msgArray, responseMsg, fileInfoReply);
-					zmq::send_multipart(socket, fileInfoReply);
-					break;
-				}
-				case CommandHandler::MessageType::ID:
-				{
-					zmq::multipart_t ipReply;
-					handleIPMessage(msgArray, responseMsg, ipReply);
-					zmq::send_multipart(socket, ipReply);
-					break;
-				}
-				default:
-					break;
+				handleRequest(socket, request, syncServer);
+				request.clear();
 			}
 		}
 
 		if (stop) {
 			break;
 		}
-
-		QThread::yieldCurrentThread();
 	}
 
 	m_mutex.lock();
@@ -30,39 +30,116 @@ any part thereof, the company/individual will have to contact Filmakademie
 #include "messageReceiver.h"
 #include <iostream>
 
-MessageReceiver::MessageReceiver(DataHub::Core* core, QList<MessageSender*> messageSenders, QString IPAdress, bool debug, bool webSockets, bool parameterHistory, bool lockHistory, zmq::context_t* context) :
-									m_senders(messageSenders), m_parameterHistory(parameterHistory), m_lockHistory(lockHistory), ZeroMQHandler(core, IPAdress, debug, webSockets, context)
+MessageReceiver::MessageReceiver(DataHub::Core* core, QList<MessageSender*> messageSenders, QString IPAdress, bool debug, bool webSockets, bool parameterHistory, bool lockHistory, bool conflateUpdates, zmq::context_t* context) :
+									m_senders(messageSenders), m_parameterHistory(parameterHistory), m_lockHistory(lockHistory), m_conflateUpdates(conflateUpdates), ZeroMQHandler(core, IPAdress, debug, webSockets, context)
 {
+	Q_ASSERT(!m_senders.isEmpty() && m_senders.count() <= s_maxSenders);
+
+	if (m_conflateUpdates)
+		connect(core, SIGNAL(tickTick(int)), this, SLOT(tickTime(int)), Qt::DirectConnection);
+}
+
+//!
+//! Slot counting the core ticks, used to close the conflation window.
+//!
+//! @param time The current tracer time.
+//!
+void MessageReceiver::tickTime(int time)
+{
+	m_tick.fetchAndAddRelaxed(1);
+}
+
+void MessageReceiver::ConflateUpdates(const MessageView& message)
+{
+	const quint16 clientID = message.clientID();
+	ParameterHistory*& buffer = m_conflationBuffers[clientID];
+
+	// the buffered messages keep the header format of the client, a recycled ID may have changed it
+	if (buffer && buffer->count() == 0 && buffer->extendedHeader() != message.isExtended())
+	{
+		delete buffer;
+		buffer = nullptr;
+	}
+
+	if (!buffer)
+		buffer = new ParameterHistory(64, message.isExtended());
+
+	const bool wasEmpty = buffer->count() == 0;
+
+	// a parameter is only buffered for the client that wrote it last, the flush
+	// order of the clients must not decide which value the others end up with
+	MessageView::ParameterUpdate update;
+	int offset = message.headerSize();
+	while (message.nextParameterUpdate(offset, update))
+	{
+		const quint64 key = update.key();
+		auto writer = m_conflationWriters.find(key);
+		if (writer == m_conflationWriters.end())
+			m_conflationWriters.insert(key, clientID);
+		else if (writer.value() != clientID)
+		{
+			m_conflationBuffers[writer.value()]->remove(key);
+			writer.value() = clientID;
+		}
+
+		buffer->update(update);
+	}
+
+	// a buffer emptied by other writers may be filled again within the tick
+	if (wasEmpty && buffer->count() > 0 && !m_conflatedClients.contains(clientID))
+	{
+		if (m_conflatedClients.isEmpty())
+			m_conflationTick = m_tick.loadRelaxed();
+		m_conflatedClients.append(clientID);
+	}
+
+	m_conflationTimes[clientID] = message.time();
+}
+
+void MessageReceiver::FlushConflatedUpdates()
+{
+	foreach(const quint16 clientID, m_conflatedClients)
+	{
+		ParameterHistory* buffer = m_conflationBuffers[clientID];
+
+		// the buffer chunks are complete messages carrying the original sender's ID
+		const QList<QByteArray> messages = buffer->snapshot(clientID, m_conflationTimes[clientID]);
+		foreach(const QByteArray& message, messages)
+			QueMessage(SharedBuffer::message(message));
+
+		buffer->clear();
+	}
+
+	m_conflatedClients.clear();
+	m_conflationWriters.clear();
 }
 
-void MessageReceiver::CheckLocks(byte clientID)
+void MessageReceiver::CheckLocks(quint16 clientID)
 {
 	//check if client had lock
-	m_lockMapMutex.lock();
-	QList<QByteArray> values = m_lockMap.values(clientID);
+	m_lockTableMutex.lock();
 
-	if (!values.isEmpty())
+	if (m_lockTable.count(clientID) > 0)
 	{
-		//release lock
+		//release all locks in one batch
 		qInfo() << "Resetting locks!";
+		zmq::multipart_t lockReleaseMessages;
 		char lockReleaseMsg[7];
-		for (int i = 0; i < values.count(); i++)
+		lockReleaseMsg[0] = static_cast<char>(m_targetHostID);
+		lockReleaseMsg[1] = static_cast<char>(m_core->m_time);  // time
+		lockReleaseMsg[2] = static_cast<char>(MessageReceiver::MessageType::LOCK);
+		lockReleaseMsg[6] = static_cast<char>(false);
+
+		m_lockTable.releaseAll(clientID, [&](byte sceneID, short objectID)
 		{
-			const char* value = values[i].constData();
-			lockReleaseMsg[0] = static_cast<char>(m_targetHostID);
-			lockReleaseMsg[1] = static_cast<char>(m_core->m_time);  // time
-			lockReleaseMsg[2] = static_cast<char>(MessageReceiver::MessageType::LOCK);
-			lockReleaseMsg[3] = value[0]; // sID
-			//memcpy(lockReleaseMsg + 4, value + 1, 2);
-			lockReleaseMsg[4] = value[1]; // oID part1
-			lockReleaseMsg[5] = value[2]; // oID part2
-			lockReleaseMsg[6] = static_cast<char>(false);
-
-			QueBroadcastMessage(std::move(zmq::message_t(lockReleaseMsg, 7)));
-			m_lockMap.remove(clientID);
-		}
+			lockReleaseMsg[3] = static_cast<char>(sceneID); // sID
+			memcpy(lockReleaseMsg + 4, &objectID, 2); // oID
+			lockReleaseMessages.addmem(lockReleaseMsg, 7);
+		});
+
+		QueBroadcastMessage(std::move(lockReleaseMessages));
 	}
-	m_lockMapMutex.unlock();
+	m_lockTableMutex.unlock();
 }
 
 
@@ -71,6 +148,11 @@ void MessageReceiver::run()
 	zmq::socket_t socket(*m_context, ZMQ_SUB);
 	socket.setsockopt(ZMQ_SUBSCRIBE, "client", 0);
 	socket.setsockopt(ZMQ_RCVTIMEO, 100);
+#ifdef ZMQ_HEARTBEAT_IVL
+	// transport level heartbeats drop dead client connections without any application traffic
+	socket.setsockopt(ZMQ_HEARTBEAT_IVL, 1000);
+	socket.setsockopt(ZMQ_HEARTBEAT_TIMEOUT, 2500);
+#endif
 	QString address = m_addressPrefix + m_IPadress + m_addressPortBase + "7";
 	socket.bind(address.toLatin1().data());
 
@@ -83,115 +165,103 @@ void MessageReceiver::run()
 		// checks if process should be aborted
 		m_mutex.lock();
 		bool stop = m_stop;
+		m_mutex.unlock();
 		
 		zmq::multipart_t messages;
 
-		//try to receive a zeroMQ message
-		zmq::recv_multipart(socket, std::back_inserter(messages), zmq::recv_flags::none);
-		m_mutex.unlock();
+		//try to receive a zeroMQ message, wait only briefly while conflated updates are pending
+		if (m_conflatedClients.isEmpty())
+			zmq::recv_multipart(socket, std::back_inserter(messages), zmq::recv_flags::none);
+		else if (zmq::poll(&item, 1, std::chrono::milliseconds(1)) > 0)
+			zmq::recv_multipart(socket, std::back_inserter(messages), zmq::recv_flags::dontwait);
+
+		// close the conflation window once the core ticked
+		if (!m_conflatedClients.isEmpty() && m_tick.loadRelaxed() != m_conflationTick)
+			FlushConflatedUpdates();
 
 		for (auto messageIter = messages.begin(); messageIter != messages.end(); messageIter++)
 		{
-			QByteArray msgArray = QByteArray((char*)messageIter->data(), static_cast<int>(messageIter->size()));
-			//QByteArray msgArray = QByteArray(static_cast<qsizetype>(messageIter->size()), Qt::Uninitialized);
-			//memcpy(msgArray.data(), messageIter->data(), messageIter->size());
+			const MessageView message(*messageIter);
+
+			if (!message.isValid())
+				continue;
+
+			const quint16 clientID = message.clientID();
+			const MessageType msgType = message.type();
+
+			// any traffic proves the client is alive, idle clients may send EMPTY messages instead of command channel pings
+			if (m_liveness)
+				m_liveness->refresh(clientID);
 
-			const unsigned char clientID = msgArray[0];
-			// char time = msgArray[1];
-			const MessageType msgType = static_cast<MessageType>(msgArray[2]);
-			//char sceneID = msgArray[3];
-			//short sceneObjectID = CharToShort(&msgArray[4]);
-			//short parameterID = CharToShort(&msgArray[6]);
+			if (msgType == MessageType::EMPTY)
+				continue;
 
 			if (m_debug)
 			{
-				if (msgType == RPC)
+				if (msgType == RPC && message.hasParameter())
 				{
 					std::cout << "RPCMsg: ";
-					std::cout << "cID: " << (int)(char)msgArray[0] + 256 << " "; //ClientID
-					std::cout << "t: " << (unsigned int)msgArray[1] << " "; //Time
-					//std::cout << "mtype: " << static_cast<MessageType>(msgArray[2]) << " "; //MessageType
-					std::cout << "sID: " << (int)(char)msgArray[3] + 256 << " "; //SceneID
-					std::cout << "oID: " << CharToShort(&msgArray[4]) << " "; //SceneObjectID
-					std::cout << "pID: " << CharToShort(&msgArray[6]); //ParamID
+					std::cout << "cID: " << (int)clientID << " "; //ClientID
+					std::cout << "t: " << (unsigned int)message.time() << " "; //Time
+					std::cout << "sID: " << (int)message.sceneID() << " "; //SceneID
+					std::cout << "oID: " << message.objectID() << " "; //SceneObjectID
+					std::cout << "pID: " << message.parameterID(); //ParamID
 					std::cout << std::endl;
 				}
 			}
 
+			// keep the order of all other messages relative to the conflated updates
+			if (msgType != MessageType::PARAMETERUPDATE && !m_conflatedClients.isEmpty())
+				FlushConflatedUpdates();
+
 			switch (msgType)
 			{
 			case MessageType::RESENDUPDATE:
 			{
 				qInfo() << "RESENDING UPDATES";
 
-				QByteArray newMessage((qsizetype)3, Qt::Uninitialized);
-				newMessage[0] = m_targetHostID;
-				newMessage[1] = m_core->m_time;
-				newMessage[2] = MessageType::PARAMETERUPDATE;
+				// the history keeps its updates pre-serialized as bounded size messages,
+				// they are handed to the senders without copying
+				const QList<QByteArray> snapshot = m_objectStates.snapshot(m_targetHostID, m_core->m_time);
+				foreach(const QByteArray& chunk, snapshot)
+					QueMessage(SharedBuffer::message(chunk), MessageSender::BULK);
 
-				foreach(QByteArray objectState, m_objectStateMap)
-				{
-					newMessage.append(objectState);
-					if (m_debug)
-					{
-						std::cout << "OutMsg (" << objectState.length() << "):";
-						foreach(const char c, objectState)
-						{
-							std::cout << " " << (int)c;
-						}
-						std::cout << std::endl;
-					}
-				}
+				if (m_debug)
+					std::cout << "OutMsg (" << m_objectStates.dataSize() << "): " << m_objectStates.count() << " parameter states in " << snapshot.size() << " messages" << std::endl;
 
-				QueMessage(std::move(zmq::message_t(newMessage.data(), newMessage.size())));
 				break;
 			}
 			case MessageType::LOCK:
 			{
+				if (!message.hasObject())
+					break;
+
 				if (m_lockHistory)
 				{
-					m_lockMapMutex.lock();
-					//store locked object for each client
-					QList<QByteArray> lockedIDs = m_lockMap.values(clientID);
-					QByteArray newValue = msgArray.sliced(3, 3);
+					const bool lockState = message.lockState();
 
-					if (lockedIDs.isEmpty())
+					//store locked object for each client
+					m_lockTableMutex.lock();
+					if (lockState)
 					{
-						if (msgArray[6])
-						{
-							m_lockMap.insert(clientID, newValue);
-						}
+						if (!m_lockTable.lock(clientID, message.sceneID(), message.objectID()) && m_debug)
+							std::cout << "Object " << message.objectID() << " already locked!" << std::endl;
 					}
 					else
 					{
-						if (msgArray[6])
-						{
-							if (lockedIDs.contains(newValue))
-							{
-								if (m_debug)
-									std::cout << "Object " << 256 + (int)(char)msgArray[6] << "already locked!" << std::endl;
-							}
-							else
-								m_lockMap.insert(clientID, newValue);
-						}
-						else
-						{
-							if (lockedIDs.contains(newValue))
-								m_lockMap.remove(clientID, newValue);
-							else if (m_debug)
-								std::cout << "Unknown Lock release request from client: " << 256 + (int)clientID << std::endl;
-						}
+						if (!m_lockTable.unlock(clientID, message.sceneID(), message.objectID()) && m_debug)
+							std::cout << "Unknown Lock release request from client: " << (int)clientID << std::endl;
 					}
-					m_lockMapMutex.unlock();
+					m_lockTableMutex.unlock();
 
 					if (m_debug)
 					{
 						std::cout << "LockMsg: ";
-						std::cout << "cID: " << (int)(char)msgArray[0] + 256 << " "; //ClientID
-						std::cout << "t: " << (unsigned int)msgArray[1] << " "; //Time
-						std::cout << "sID: " << (int)(char)msgArray[3] + 256 << " "; //SceneObjectID
-						std::cout << "oID: " << CharToShort(&msgArray[4]) << " "; //SceneObjectID
-						std::cout << "state: " << (unsigned int)msgArray[6]; //lock state
+						std::cout << "cID: " << (int)clientID << " "; //ClientID
+						std::cout << "t: " << (unsigned int)message.time() << " "; //Time
+						std::cout << "sID: " << (int)message.sceneID() << " "; //SceneID
+						std::cout << "oID: " << message.objectID() << " "; //SceneObjectID
+						std::cout << "state: " << lockState; //lock state
 						std::cout << std::endl;
 					}
 				}
@@ -202,18 +272,18 @@ void MessageReceiver::run()
 			{
 				if (m_parameterHistory)
 				{
-					int start = 3;
-					while (start < msgArray.size())
+					MessageView::ParameterUpdate update;
+					int offset = message.headerSize();
+					while (message.nextParameterUpdate(offset, update))
 					{
-						const int length = CharToInt(msgArray.sliced(start + 6, 4));
-						
-						if (!m_objectStateMap.contains(msgArray.sliced(start, 5)))
-							m_objectStateMap.insert(msgArray.sliced(start, 5), msgArray.sliced(start, length));
-						
-						start += length;
+						m_objectStates.update(update);
 					}
 				}
-				QueMessage(std::move(*messageIter));
+
+				if (m_conflateUpdates)
+					ConflateUpdates(message);
+				else
+					QueMessage(std::move(*messageIter));
 				break;
 			}
 			case MessageType::SYNC:
@@ -228,8 +298,6 @@ void MessageReceiver::run()
 		if (stop) {
 			break;
 		}
-
-		QThread::yieldCurrentThread();
 	}
 
 	// Set _working to false -> process cannot be aborted anymore
@@ -28,12 +28,40 @@ any part thereof, the company/individual will have to contact Filmakademie
 */
 
 #include "messageSender.h"
+#include "messageView.h"
+#include "sharedBuffer.h"
 #include <iostream>
+#include <limits>
+#include <optional>
 
-MessageSender::MessageSender(DataHub::Core* core, QString IPAdress, bool debug, bool webSockets, zmq::context_t* context) :
-    ZeroMQHandler(core, IPAdress, debug, webSockets, context)
+MessageSender::MessageSender(DataHub::Core* core, QString IPAdress, bool debug, bool webSockets, int batchDivisor, bool extendedHeader, zmq::context_t* context) :
+    ZeroMQHandler(core, IPAdress, debug, webSockets, context), m_batchDivisor(batchDivisor), m_extendedHeader(extendedHeader), m_overtaken(64, extendedHeader)
 {
+    // bulk data is sent in small portions so that control messages can overtake it
+    m_lanes[CONTROL].budget = std::numeric_limits<size_t>::max();
+    m_lanes[INTERACTIVE].budget = 1024 * 1024;
+    m_lanes[BULK].budget = 256 * 1024;
+    m_clock.start();
+
 	connect(core, SIGNAL(tickSecondRandom(int)), this, SLOT(createSyncMessage(int)), Qt::DirectConnection);
+
+    if (m_batchDivisor > 0)
+        connect(core, SIGNAL(tickTick(int)), this, SLOT(tickTime(int)), Qt::DirectConnection);
+}
+
+//!
+//! Slot counting the core ticks to trigger batched sends.
+//!
+//! @param time The current tracer time.
+//!
+void MessageSender::tickTime(int time)
+{
+    if (++m_batchTicks < m_batchDivisor)
+        return;
+
+    m_batchTicks = 0;
+    m_batchDue.store(true);
+    wakeSender();
 }
 
 //!
@@ -43,22 +71,287 @@ MessageSender::MessageSender(DataHub::Core* core, QString IPAdress, bool debug,
 //!
 void MessageSender::createSyncMessage(int time)
 {
-    m_mutex.lock();
-    m_syncMessage[0] = m_targetHostID;
-    m_syncMessage[1] = time;
-    m_syncMessage[2] = MessageType::SYNC;
-    m_mutex.unlock();
+    const byte syncMessage[3] = { m_targetHostID, static_cast<byte>(time), MessageType::SYNC };
+    QueBroadcastMessage(zmq::message_t(syncMessage, 3));
 
     //std::cout << "\r" << "Time: " << time << " ";
 }
 
+//!
+//! Returns true if there is nothing to send right now.
+//!
+bool MessageSender::isIdle() const
+{
+    if (m_batchDivisor > 0)
+        return m_lanes[CONTROL].queue.isEmpty() && !m_batchDue.load();
+
+    for (const Lane& lane : m_lanes)
+        if (!lane.queue.isEmpty())
+            return false;
+    return true;
+}
+
+//!
+//! Converts the message to the header format of the sender's clients if needed.
+//! Messages are queued in the format they were received or created in, so
+//! the copy is only made for clients of the other format, on the sender thread.
+//!
+void MessageSender::convertHeader(zmq::message_t& message) const
+{
+    const MessageView view(message);
+    if (view.isValid() && view.isExtended() != m_extendedHeader)
+        message = view.convert(m_extendedHeader);
+}
+
+//!
+//! Counts the subscriptions and unsubscriptions the clients sent to the socket.
+//! The socket reports the first subscription and the last unsubscription of
+//! every topic, so the count only drops to zero once no client listens.
+//!
+void MessageSender::readSubscriptions(zmq::socket_t& sender)
+{
+    zmq::message_t subscription;
+    while (sender.recv(subscription, zmq::recv_flags::dontwait))
+    {
+        if (subscription.size() == 0)
+            continue;
+        m_subscriptions += static_cast<const char*>(subscription.data())[0] == 1 ? 1 : -1;
+    }
+}
+
+//!
+//! Collects the wait time statistics of a message taken from the lane.
+//!
+void MessageSender::countWait(Lane& lane, const QueuedMessage& message, qint64 now)
+{
+    const qint64 wait = now - message.time;
+    lane.waitTotal += wait;
+    lane.waitMax = qMax(lane.waitMax, wait);
+    lane.count++;
+}
+
+//!
+//! Returns the queue time of the oldest bulk message.
+//! A resend snapshot holds the parameter states of the time it was requested,
+//! updates queued after it overtake it and are sent again once it is out.
+//!
+qint64 MessageSender::bulkTime() const
+{
+    const QueuedMessage* bulk = m_lanes[BULK].queue.front();
+    return bulk ? bulk->time : std::numeric_limits<qint64>::max();
+}
+
+//!
+//! Remembers the latest values of the parameter updates of a message that overtakes a resend snapshot.
+//!
+void MessageSender::recordOvertaken(const zmq::message_t& message)
+{
+    const MessageView view(message);
+    if (!view.isValid() || view.type() != MessageType::PARAMETERUPDATE)
+        return;
+
+    MessageView::ParameterUpdate update;
+    int offset = view.headerSize();
+    while (view.nextParameterUpdate(offset, update))
+        m_overtaken.update(update);
+}
+
+//!
+//! Sends the updates that overtook the resend snapshots again once the snapshots are out,
+//! so that the clients end up with the latest values instead of the snapshot's.
+//!
+void MessageSender::resendOvertaken(zmq::socket_t& sender)
+{
+    if (m_overtaken.count() == 0 || !m_lanes[BULK].queue.isEmpty())
+        return;
+
+    zmq::multipart_t messages;
+    const QList<QByteArray> snapshot = m_overtaken.snapshot(m_targetHostID, static_cast<byte>(m_core->m_time));
+    foreach(const QByteArray& chunk, snapshot)
+        messages.add(SharedBuffer::message(chunk));
+    m_overtaken.clear();
+
+    if (m_subscriptions > 0)
+        zmq::send_multipart(sender, std::move(messages));
+}
+
+//!
+//! Sends the queued messages of the class up to its budget as one multipart message.
+//!
+void MessageSender::flush(zmq::socket_t& sender, Lane& lane, qint64 snapshotTime)
+{
+    zmq::multipart_t messages;
+    QueuedMessage queued;
+    size_t size = 0;
+    size_t count = 0;
+    bool overtaking = false;
+    const qint64 now = m_clock.nsecsElapsed();
+
+    auto add = [&](zmq::message_t&& message)
+    {
+        // nobody would receive it, skip the header conversion
+        if (m_subscriptions == 0)
+            return;
+
+        convertHeader(message);
+        if (overtaking)
+            recordOvertaken(message);
+        size += message.size();
+        messages.add(std::move(message));
+    };
+
+    // stop at the budget or after one queue length so that busy producers
+    // can not starve the other classes, a batch is always taken as a whole
+    while (size < lane.budget && count < lane.queue.capacity())
+    {
+        const QueuedMessage* next = lane.queue.front();
+        if (!next || !lane.queue.tryPop(queued))
+            break;
+
+        countWait(lane, queued, now);
+        count++;
+        overtaking = queued.time > snapshotTime;
+
+        if (queued.batch)
+        {
+            while (!queued.batch->empty())
+                add(queued.batch->pop());
+            queued.batch.reset();
+        }
+        else
+            add(std::move(queued.message));
+    }
+
+    if (!messages.empty())
+        zmq::send_multipart(sender, std::move(messages));
+}
+
+//!
+//! Sends all queued messages of the class, merging parameter updates per client.
+//! Consecutive parameter updates of the same client are packed into one frame,
+//! all messages keep their order, so the last update of a parameter always wins.
+//!
+void MessageSender::flushBatch(zmq::socket_t& sender, Lane& lane, qint64 snapshotTime)
+{
+    //! The consecutive parameter updates of one client.
+    struct ClientUpdates
+    {
+        quint16 clientID;
+        zmq::message_t first;
+        QByteArray merged;
+    };
+
+    zmq::multipart_t messages;
+    std::optional<ClientUpdates> run;
+    QueuedMessage queued;
+    size_t count = 0;
+    bool overtaking = false;
+    const qint64 now = m_clock.nsecsElapsed();
+
+    auto closeRun = [&]()
+    {
+        if (!run)
+            return;
+
+        if (run->merged.isEmpty())
+            messages.add(std::move(run->first));
+        else
+            messages.add(SharedBuffer::message(run->merged));
+        run.reset();
+    };
+
+    auto add = [&](zmq::message_t&& frame)
+    {
+        if (m_subscriptions == 0)
+            return;
+
+        convertHeader(frame);
+        if (overtaking)
+            recordOvertaken(frame);
+
+        const MessageView message(frame);
+        const int headerSize = message.headerSize();
+
+        if (message.size() <= headerSize || message.type() != MessageType::PARAMETERUPDATE)
+        {
+            closeRun();
+            messages.add(std::move(frame));
+            return;
+        }
+
+        // updates of another client end the run, merging across clients would reorder their updates
+        const quint16 clientID = message.clientID();
+        if (run && run->clientID != clientID)
+            closeRun();
+
+        if (!run)
+        {
+            run.emplace(ClientUpdates{ clientID, std::move(frame), QByteArray() });
+        }
+        else
+        {
+            if (run->merged.isEmpty())
+                run->merged = QByteArray(static_cast<const char*>(run->first.data()), static_cast<qsizetype>(run->first.size()));
+            // header of the first update, time of the latest
+            run->merged[headerSize - 2] = static_cast<char>(message.time());
+            run->merged.append(message.data() + headerSize, message.size() - headerSize);
+        }
+    };
+
+    while (count < lane.queue.capacity())
+    {
+        const QueuedMessage* next = lane.queue.front();
+        if (!next || !lane.queue.tryPop(queued))
+            break;
+
+        countWait(lane, queued, now);
+        count++;
+        overtaking = queued.time > snapshotTime;
+
+        if (queued.batch)
+        {
+            while (!queued.batch->empty())
+                add(queued.batch->pop());
+            queued.batch.reset();
+        }
+        else
+            add(std::move(queued.message));
+    }
+
+    closeRun();
+
+    if (!messages.empty())
+        zmq::send_multipart(sender, std::move(messages));
+}
+
+//!
+//! Prints and resets the queue wait statistics of all priority classes.
+//!
+void MessageSender::reportWaitTimes()
+{
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+    {
+        Lane& lane = m_lanes[i];
+        if (lane.count > 0)
+        {
+            qInfo().nospace() << metaObject()->className() << " " << s_priorityNames[i] << " queue wait: avg " 
+                << lane.waitTotal / lane.count / 1000 << " us, max " << lane.waitMax / 1000 << " us, " << lane.count << " messages";
+        }
+        lane.waitTotal = 0;
+        lane.waitMax = 0;
+        lane.count = 0;
+    }
+}
+
 //!
 //! The broadcast thread's main worker loop.
 //!
 void MessageSender::run()
 {
-	zmq::socket_t sender(*m_context, ZMQ_PUB);
-    QString address = m_addressPrefix + m_IPadress + m_addressPortBase + "6";
+	// a XPUB socket tells whether any client is subscribed
+	zmq::socket_t sender(*m_context, ZMQ_XPUB);
+    // clients using the extended header subscribe to their own port
+    QString address = m_addressPrefix + m_IPadress + m_addressPortBase + (m_extendedHeader ? "9" : "6");
 	sender.bind(address.toLatin1().data());
 
     startInfo(address);
@@ -68,31 +361,44 @@ void MessageSender::run()
         // checks if process should be aborted
         m_mutex.lock();
         bool stop = m_stop;
+        m_mutex.unlock();
+
+        // sleep until a message is queued or the process shall stop
+        m_sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!stop && isIdle())
+            m_wakeup.tryAcquire(1, s_idleTimeout);
+        m_sleeping.store(false);
 
-        if (m_syncMessage[2] != MessageType::EMPTY)
+        readSubscriptions(sender);
+
+        // the queues are drained without holding any lock, higher classes first,
+        // interactive messages never wait for a resend snapshot, the updates
+        // that overtake it are sent again once its last portion is out
+        flush(sender, m_lanes[CONTROL]);
+
+        if (m_batchDivisor == 0)
         {
-            sender.send(m_syncMessage, 3);
-            m_syncMessage[2] = MessageType::EMPTY;
+            flush(sender, m_lanes[INTERACTIVE], bulkTime());
+            flush(sender, m_lanes[BULK]);
+            resendOvertaken(sender);
         }
-
-        if (!m_broadcastMessageList.empty())
+        else if (m_batchDue.exchange(false))
         {
-            zmq::send_multipart(sender, std::move(m_broadcastMessageList));
-            m_broadcastMessageList.clear();
+            flushBatch(sender, m_lanes[INTERACTIVE], bulkTime());
+            flush(sender, m_lanes[BULK]);
+            resendOvertaken(sender);
         }
 
-        if (!m_messageList.empty()) {
-            zmq::send_multipart(sender, std::move(m_messageList));
-            m_messageList.clear();
+        if (m_debug && m_clock.nsecsElapsed() - m_reportTime > 1000000000ll)
+        {
+            reportWaitTimes();
+            m_reportTime = m_clock.nsecsElapsed();
         }
 
-        m_mutex.unlock();
-        
         if (stop) {
             break;
         }
-
-        QThread::yieldCurrentThread();
     }
 
 
@@ -105,4 +411,3 @@ void MessageSender::run()
 
     emit stopped(this);
 }
-
@@ -28,75 +28,462 @@ any part thereof, the company/individual will have to contact Filmakademie
 */
 
 #include "sceneReceiver.h"
+#include "sceneSender.h"
 
-SceneReceiver::SceneReceiver(DataHub::Core* core, QString IPAdress, bool debug, zmq::context_t* context) 
-	: ZeroMQHandler(core, IPAdress, debug, false, context)
+SceneReceiver::SceneReceiver(DataHub::Core* core, QString IPAdress, SceneCatalog* sceneCatalog, ScenePartCache* partCache, SceneSender* relay, TransferMode mode, bool debug, zmq::context_t* context) 
+	: ZeroMQHandler(core, IPAdress, debug, false, context), m_sceneCatalog(sceneCatalog), m_partCache(partCache), m_relay(relay), m_mode(mode)
 {
 	m_requests = { "header", "nodes", "parameterobjects", "objects", "characters", "textures", "materials" };
 }
 
 SceneReceiver::~SceneReceiver()
 {
-	delete m_sceneData;
 }
 
 
-void SceneReceiver::run()
+bool SceneReceiver::isStopped()
 {
-	zmq::socket_t socket(*m_context, ZMQ_REQ);
-	//socket.setsockopt(ZMQ_SNDTIMEO, 200);
-
-	QString address = "tcp://" + m_IPadress + ":5555";
-	socket.connect(address.toLatin1().data());
+	m_mutex.lock();
+	bool stop = m_stop;
+	m_mutex.unlock();
+	return stop;
+}
 
-	m_sceneData = new SceneDataHandler();
+void SceneReceiver::addPart(int index, const SharedBuffer::Pointer& part, SceneWriter& writer, const QString& stamp, const SceneManifest::Part* entry)
+{
+	// relayed parts are served from memory right away
+	if (part && m_relay && m_partCache)
+		m_partCache->insert(m_IPadress, stamp, index, part);
 
-	startInfo(address);
+	m_hasScene |= bool(part);
+	writer.addPart(index, part, entry);
+}
 
+bool SceneReceiver::receiveParts(zmq::socket_t& socket, SceneWriter& writer, const QString& stamp)
+{
 	for (int i = 0; i < m_requests.count(); i++)
 	{
-		if (!socket.send(zmq::message_t(m_requests[i].toStdString())))
-			continue;
+		// REQ envelope: empty delimiter, request
+		zmq::multipart_t request;
+		request.add(zmq::message_t());
+		request.addstr(m_requests[i].toStdString());
+		request.send(socket);
 
 		qDebug() << "Request: " << m_requests[i];
+	}
+
+	zmq::pollitem_t item = { static_cast<void*>(socket), 0, ZMQ_POLLIN, 0 };
+	int received = 0;
 
-		zmq::message_t recvMessage;
-		socket.recv(recvMessage);
+	while (received < m_requests.count() && !isStopped())
+	{
+		if (zmq::poll(&item, 1, std::chrono::milliseconds(100)) <= 0)
+			continue;
 
-		qDebug() << m_requests[i] << " " << recvMessage.size();
+		zmq::multipart_t reply;
+		if (!reply.recv(socket, ZMQ_DONTWAIT) || reply.empty())
+			continue;
 
-		if (recvMessage.size() > 0)
+		// replies arrive in request order, every part is stored as it arrives
+		const SharedBuffer::Pointer part = SharedBuffer::fromMessage(reply.remove());
+
+		qDebug() << m_requests[received] << " " << (part ? part->size() : 0);
+
+		addPart(received++, part, writer, stamp);
+	}
+
+	// a scene is only stored complete
+	return received == m_requests.count();
+}
+
+bool SceneReceiver::receiveChunked(zmq::socket_t& socket, SceneWriter& writer, const QString& stamp)
+{
+	const QString dirPath = "./" + m_IPadress + "/";
+	QDir().mkpath(dirPath);
+
+	zmq::pollitem_t item = { static_cast<void*>(socket), 0, ZMQ_POLLIN, 0 };
+	QElapsedTimer replyTimer;
+
+	for (int i = 0; i < m_requests.count(); i++)
+	{
+		// the received bytes of an interrupted transfer are kept and continued,
+		// the file starts with the checksum of the part they belong to
+		QFile file(partialPath(i));
+		if (!file.open(QIODevice::ReadWrite | QIODevice::Append))
 		{
-			switch (i)
+			qInfo() << "Could not open" << file.fileName();
+			return false;
+		}
+
+		quint64 checksum = 0;
+		const bool resumed = file.size() > s_partialHeaderSize && file.seek(0) && file.read(reinterpret_cast<char*>(&checksum), s_partialHeaderSize) == s_partialHeaderSize;
+		qint64 received = resumed ? file.size() - s_partialHeaderSize : 0;
+		qint64 requested = received;
+		qint64 total = -1;
+		int inFlight = 0;
+
+		if (resumed)
+			qDebug() << "Resuming" << m_requests[i] << "at" << received;
+
+		replyTimer.start();
+
+		while (total < 0 || received < total)
+		{
+			// the total size comes with the first reply, until then a single chunk is requested
+			const int window = total < 0 ? 1 : s_maxChunksInFlight;
+			while (inFlight < window && (total < 0 || requested < total))
 			{
-			case 0: // header
-				m_sceneData->headerByteData = toByteArray(recvMessage);
-				break;
-			case 1: // nodes
-				m_sceneData->nodesByteData = toByteArray(recvMessage);
-				break;
-			case 2: // parameterobjects
-				m_sceneData->parameterObjectsByteData = toByteArray(recvMessage);
-				break;
-			case 3: // objects
-				m_sceneData->objectsByteData = toByteArray(recvMessage);
-				break;
-			case 4: // characters
-				m_sceneData->characterByteData = toByteArray(recvMessage);
-				break;
-			case 5: // textures
-				m_sceneData->texturesByteData = toByteArray(recvMessage);
-				break;
-			case 6: // materials
-				m_sceneData->materialsByteData = toByteArray(recvMessage);
+				zmq::multipart_t request;
+				request.add(zmq::message_t());
+				request.addstr(m_requests[i].toStdString() + ":" + std::to_string(requested));
+				request.send(socket);
+
+				requested += SceneDataHandler::s_chunkSize;
+				inFlight++;
+			}
+
+			if (isStopped())
+				return false;
+
+			if (zmq::poll(&item, 1, std::chrono::milliseconds(100)) <= 0)
+			{
+				if (replyTimer.elapsed() > s_replyTimeout)
+				{
+					qInfo() << "Scene transfer timed out, " << received << " bytes of " << m_requests[i] << " kept for resume.";
+					return false;
+				}
+				continue;
+			}
+
+			// envelope: empty delimiter, total size, offset, checksum of the part, chunk
+			zmq::multipart_t reply;
+			if (!reply.recv(socket, ZMQ_DONTWAIT) || reply.size() < 5 || reply[1].size() != sizeof(qint64) || reply[2].size() != sizeof(qint64) || reply[3].size() != sizeof(quint64))
+				continue;
+
+			inFlight--;
+			replyTimer.restart();
+
+			qint64 offset = 0;
+			quint64 partChecksum = 0;
+			std::memcpy(&total, reply[1].data(), sizeof(qint64));
+			std::memcpy(&offset, reply[2].data(), sizeof(qint64));
+			std::memcpy(&partChecksum, reply[3].data(), sizeof(quint64));
+			const zmq::message_t& chunk = reply[4];
+
+			if (file.size() < s_partialHeaderSize || partChecksum != checksum || received > total)
+			{
+				// the kept bytes belong to another version of the part, start over
+				if (received > 0)
+					qInfo() << "The kept bytes of" << m_requests[i] << "belong to another version, starting over.";
+
+				if (!file.resize(0) || file.write(reinterpret_cast<const char*>(&partChecksum), s_partialHeaderSize) != s_partialHeaderSize)
+				{
+					qInfo() << "Could not reset" << file.fileName();
+					return false;
+				}
+				checksum = partChecksum;
+
+				// replies requested before the transfer started over are dropped by their offset
+				if (received > 0)
+				{
+					received = requested = 0;
+					continue;
+				}
+			}
+
+			// replies requested before the transfer started over
+			if (offset != received)
+				continue;
+
+			if (chunk.size() == 0)
 				break;
+
+			if (file.write(static_cast<const char*>(chunk.data()), static_cast<qint64>(chunk.size())) != static_cast<qint64>(chunk.size()))
+			{
+				qInfo() << "Could not write" << file.fileName() << ", " << received << " bytes of " << m_requests[i] << " kept for resume.";
+				return false;
 			}
+			received += static_cast<qint64>(chunk.size());
+		}
+
+		file.close();
+
+		qDebug() << m_requests[i] << " " << received;
+
+		// complete parts stay in their .partial file until the whole scene is stored
+		if (received != total)
+		{
+			qInfo() << "Scene transfer incomplete, " << received << " bytes of " << m_requests[i] << " kept for resume.";
+			return false;
+		}
+
+		// the part is checked as a whole before it is stored, a damaged one is received again next time
+		const SharedBuffer::Pointer part = SharedBuffer::map(partialPath(i), s_partialHeaderSize, -1);
+		if (Hash::xxh64(part ? part->data() : nullptr, part ? part->size() : 0) != checksum)
+		{
+			qInfo() << "Received" << m_requests[i] << "does not match its checksum, discarded.";
+			QFile::remove(partialPath(i));
+			return false;
 		}
+
+		// the writer takes over the verified checksum
+		SceneManifest::Part entry;
+		entry.size = received;
+		entry.checksum = checksum;
+		addPart(i, part, writer, stamp, &entry);
 	}
 
-	if (!m_sceneData->isEmpty())
+	return true;
+}
+
+QStringList SceneReceiver::partialPaths() const
+{
+	QStringList paths;
+	for (int i = 0; i < m_requests.count(); i++)
+		paths.append(partialPath(i));
+	return paths;
+}
+
+QList<SceneManifest::Part> SceneReceiver::cachedParts() const
+{
+	// the most recently stored version
+	const QString dirPath = "./" + m_IPadress + "/";
+	const QStringList manifests = QDir(dirPath).entryList({ "*" + SceneManifest::s_extension }, QDir::Files, QDir::Time);
+	if (manifests.isEmpty())
+		return QList<SceneManifest::Part>();
+
+	const QSharedPointer<SceneManifest> manifest = SceneManifest::open(dirPath + manifests[0]);
+	return manifest ? manifest->parts() : QList<SceneManifest::Part>();
+}
+
+QHash<ChunkStore::Chunk, SharedBuffer::Pointer> SceneReceiver::cachedChunks(const QList<SceneManifest::Part>& parts) const
+{
+	const ChunkStore store("./" + m_IPadress + "/");
+	QHash<ChunkStore::Chunk, SharedBuffer::Pointer> chunks;
+	QHash<quint64, SharedBuffer::Pointer> packs;
+
+	// the chunks are ranges of their packs, the assembled parts are checked against their checksum
+	foreach(const SceneManifest::Part& part, parts)
 	{
-		m_sceneData->writeToDisk("./", m_IPadress, QDateTime::currentDateTime().toString("dd-MM-yyyy_hh-mm-ss"));
+		foreach(const ChunkStore::Chunk& chunk, part.chunks)
+		{
+			if (!packs.contains(chunk.pack))
+				packs.insert(chunk.pack, store.load(chunk.pack));
+
+			const SharedBuffer::Pointer data = SharedBuffer::slice(packs.value(chunk.pack), chunk.offset, chunk.size);
+			if (data)
+				chunks.insert(chunk, data);
+		}
+	}
+
+	return chunks;
+}
+
+SharedBuffer::Pointer SceneReceiver::assemble(const SceneManifest::Part& part, zmq::multipart_t& chunks, const QList<ChunkStore::Chunk>& known, const QHash<ChunkStore::Chunk, SharedBuffer::Pointer>& cached)
+{
+	if (part.size == 0)
+		return SharedBuffer::Pointer();
+
+	// the chunks arrive in the order of the part, without the known ones and without repetitions
+	const QSet<ChunkStore::Chunk> skipped(known.cbegin(), known.cend());
+	QHash<ChunkStore::Chunk, const char*> placed;
+
+	zmq::message_t data(static_cast<size_t>(part.size));
+	char* target = static_cast<char*>(data.data());
+
+	foreach(const ChunkStore::Chunk& chunk, part.chunks)
+	{
+		const char* source = placed.value(chunk);
+		zmq::message_t received;
+
+		if (!source && skipped.contains(chunk))
+		{
+			const SharedBuffer::Pointer local = cached.value(chunk);
+			source = local ? local->data() : nullptr;
+		}
+		else if (!source && !chunks.empty())
+		{
+			received = chunks.pop();
+			if (static_cast<qint64>(received.size()) == chunk.size)
+				source = static_cast<const char*>(received.data());
+		}
+
+		if (!source)
+			return SharedBuffer::Pointer();
+
+		std::memcpy(target, source, chunk.size);
+		placed.insert(chunk, target);
+		target += chunk.size;
+	}
+
+	// the received chunks are verified once, with the whole part
+	if (!chunks.empty() || Hash::xxh64(data.data(), part.size) != part.checksum)
+		return SharedBuffer::Pointer();
+
+	return SharedBuffer::fromMessage(std::move(data));
+}
+
+bool SceneReceiver::receiveDelta(zmq::socket_t& socket, SceneWriter& writer, const QString& stamp)
+{
+	const QList<SceneManifest::Part> cached = cachedParts();
+	const QHash<ChunkStore::Chunk, SharedBuffer::Pointer> chunks = cachedChunks(cached);
+
+	for (int i = 0; i < m_requests.count(); i++)
+	{
+		// the chunks of the stored version are not sent again
+		QByteArray known;
+		if (i < cached.count())
+			ChunkStore::encode(cached[i].chunks, known);
+
+		zmq::multipart_t request;
+		request.add(zmq::message_t());
+		request.addstr(m_requests[i].toStdString() + ":delta");
+		request.addmem(known.constData(), known.size());
+		request.send(socket);
+
+		qDebug() << "Request: " << m_requests[i] << "with" << (i < cached.count() ? cached[i].chunks.count() : 0) << "known chunks";
+	}
+
+	zmq::pollitem_t item = { static_cast<void*>(socket), 0, ZMQ_POLLIN, 0 };
+	QElapsedTimer replyTimer;
+	replyTimer.start();
+	int received = 0;
+
+	while (received < m_requests.count() && !isStopped())
+	{
+		if (zmq::poll(&item, 1, std::chrono::milliseconds(100)) <= 0)
+		{
+			if (replyTimer.elapsed() > s_replyTimeout)
+			{
+				qInfo() << "Scene transfer timed out at" << m_requests[received];
+				return false;
+			}
+			continue;
+		}
+
+		// envelope: empty delimiter, part entry, chunks, parts without new chunks have none
+		zmq::multipart_t reply;
+		if (!reply.recv(socket, ZMQ_DONTWAIT) || reply.size() < 2)
+			continue;
+
+		replyTimer.restart();
+		reply.pop();
+		const zmq::message_t entry = reply.pop();
+		const QString& name = m_requests[received];
+
+		if (entry.size() == 0)
+		{
+			// parts stored without a manifest come whole
+			const SharedBuffer::Pointer part = reply.empty() ? SharedBuffer::Pointer() : SharedBuffer::fromMessage(reply.pop());
+
+			qDebug() << name << " " << (part ? part->size() : 0);
+
+			addPart(received++, part, writer, stamp);
+			continue;
+		}
+
+		SceneManifest::Part manifestPart;
+		if (!SceneManifest::decode(entry.data(), static_cast<qint64>(entry.size()), manifestPart))
+		{
+			qInfo() << "Invalid delta of" << name;
+			return false;
+		}
+
+		const SharedBuffer::Pointer part = assemble(manifestPart, reply, received < cached.count() ? cached[received].chunks : QList<ChunkStore::Chunk>(), chunks);
+		if (!part && manifestPart.size > 0)
+		{
+			qInfo() << "Delta of" << name << "could not be applied.";
+			return false;
+		}
+
+		qDebug() << name << " " << manifestPart.size;
+
+		// the part is stored with the chunk list it came with
+		addPart(received++, part, writer, stamp, &manifestPart);
+	}
+
+	return received == m_requests.count();
+}
+
+QString SceneReceiver::partialPath(int index) const
+{
+	return "./" + m_IPadress + "/incoming" + SceneDataHandler::partSuffix(index) + ".partial";
+}
+
+void SceneReceiver::run()
+{
+	// a DEALER can queue all requests at once, the scene server's REP socket
+	// answers them one after another without waiting for a round trip each
+	zmq::socket_t socket(*m_context, ZMQ_DEALER);
+	socket.setsockopt(ZMQ_LINGER, 0);
+
+	QString address = "tcp://" + m_IPadress + ":5555";
+	socket.connect(address.toLatin1().data());
+
+	startInfo(address);
+
+	const QString stamp = QDateTime::currentDateTime().toString("dd-MM-yyyy_hh-mm-ss");
+
+	// the catalog ignores the changes of the scene directory until the scene is written
+	if (m_sceneCatalog)
+		m_sceneCatalog->beginWrite(m_IPadress);
+
+	// clients asking for the scene are served the parts as they arrive
+	if (m_relay)
+		m_relay->publishIncomingScene(m_IPadress, stamp);
+
+	// the parts are stored by the I/O thread as they arrive
+	SceneWriter writer("./", m_IPadress, stamp);
+	bool received = false;
+	switch (m_mode)
+	{
+		case CHUNKED:
+			received = receiveChunked(socket, writer, stamp);
+			break;
+		case DELTA:
+			received = receiveDelta(socket, writer, stamp);
+			break;
+		default:
+			received = receiveParts(socket, writer, stamp);
+			break;
+	}
+
+	SceneCatalog* sceneCatalog = m_sceneCatalog;
+	SceneSender* relay = m_relay;
+	const QString serverID = m_IPadress;
+
+	if (received && m_hasScene)
+	{
+		// the receiver is done, the I/O thread completes the scene once all parts are stored
+		const QStringList partials = m_mode == CHUNKED ? partialPaths() : QStringList();
+		writer.finish([sceneCatalog, relay, serverID, stamp, partials](bool stored)
+		{
+			if (stored)
+			{
+				foreach(const QString& partial, partials)
+					QFile::remove(partial);
+
+			}
+
+			// the catalog only lists the scene once its manifest is on disk
+			if (sceneCatalog)
+				sceneCatalog->endWrite(serverID);
+
+			if (relay)
+				relay->completeIncomingScene(serverID, stamp, stored);
+		});
+	}
+	else
+	{
+		// the version is never written, the .partial files are kept for resuming
+		writer.discard([sceneCatalog, serverID]()
+		{
+			if (sceneCatalog)
+				sceneCatalog->endWrite(serverID);
+		});
+
+		if (relay)
+			relay->completeIncomingScene(serverID, stamp, false);
 	}
 
 	m_mutex.lock();
@@ -106,4 +493,4 @@ void SceneReceiver::run()
 	stopInfo(address);
 
 	emit stopped(this);
-}
\ No newline at end of file
+}
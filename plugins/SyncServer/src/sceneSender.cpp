@@ -29,49 +29,418 @@ any part thereof, the company/individual will have to contact Filmakademie
 
 #include "sceneSender.h"
 
-SceneSender::SceneSender(DataHub::Core* core, QString serverAddress, QString clientAddress, bool debug, zmq::context_t* context)
-	: ZeroMQHandler(core, serverAddress, debug, false, context), m_clientAddress(clientAddress)
+SceneSender::SceneSender(DataHub::Core* core, QString IPAddress, SceneCatalog* sceneCatalog, ScenePartCache* partCache, bool debug, zmq::context_t* context)
+	: ZeroMQHandler(core, IPAddress, debug, false, context), m_sceneCatalog(sceneCatalog), m_partCache(partCache), m_scene(new Scene())
 {
-	m_sceneData = new SceneDataHandler();
+	m_clock.start();
 }
 
 SceneSender::~SceneSender()
 {
-	delete m_sceneData;
 }
 
-bool SceneSender::loadData()
+void SceneSender::publishScene(const QString& serverID)
 {
-	m_sceneData->readFromDisk("./", m_clientAddress, 0 /*file list entry number*/);
+	m_sceneMutex.lock();
+	m_publishedScene = serverID;
+	m_publishedStamp.clear();
+	m_publishedIncoming = false;
+	m_scenePublished = true;
+	m_sceneMutex.unlock();
+}
 
-	if (m_sceneData->isEmpty())
-		false;
+void SceneSender::publishIncomingScene(const QString& serverID, const QString& stamp)
+{
+	m_sceneMutex.lock();
+	m_publishedScene = serverID;
+	m_publishedStamp = stamp;
+	m_publishedIncoming = true;
+	m_scenePublished = true;
+	m_receivingScenes.insert(receivingKey(serverID, stamp));
+	m_sceneMutex.unlock();
+}
 
-	m_responses.insert("header", &m_sceneData->headerByteData);
-	m_responses.insert("nodes", &m_sceneData->nodesByteData);
-	m_responses.insert("parameterobjects", &m_sceneData->parameterObjectsByteData);
-	m_responses.insert("objects", &m_sceneData->objectsByteData);
-	m_responses.insert("characters", &m_sceneData->characterByteData);
-	m_responses.insert("textures", &m_sceneData->texturesByteData);
-	m_responses.insert("materials", &m_sceneData->materialsByteData);
+void SceneSender::completeIncomingScene(const QString& serverID, const QString& stamp, bool received)
+{
+	m_sceneMutex.lock();
+	// clients downloading the scene get the parts that arrived, missing ones as empty messages
+	m_receivingScenes.remove(receivingKey(serverID, stamp));
+	// a scene published in the meantime stays
+	if (m_publishedIncoming && m_publishedScene == serverID && m_publishedStamp == stamp)
+	{
+		// without a received scene the stored one is served again
+		if (!received)
+			m_publishedStamp.clear();
+		m_publishedIncoming = false;
+		m_scenePublished = true;
+	}
+	m_sceneMutex.unlock();
 
-	return true;
+	// the received parts are on disk now, they are kept like any other part
+	if (m_partCache)
+		m_partCache->release(serverID, stamp);
 }
 
+QString SceneSender::receivingKey(const QString& serverID, const QString& stamp)
+{
+	return serverID + "/" + stamp;
+}
 
-void SceneSender::run()
+QSharedPointer<SceneSender::Scene> SceneSender::loadScene(const QString& serverID, const QString& stamp)
+{
+	QSharedPointer<Scene> scene(new Scene());
+	scene->serverID = serverID;
+	scene->stamp = stamp;
+
+	// a relayed scene is served in the version being received
+	if (!stamp.isEmpty())
+	{
+		scene->versions.fill(stamp, SceneDataHandler::s_partCount);
+		qInfo() << "Relaying scene of" << serverID;
+		return scene;
+	}
+
+	const QString path = m_sceneCatalog ? m_sceneCatalog->path() : "./";
+	const QList<QStringList> fileNames = m_sceneCatalog ? m_sceneCatalog->info(serverID) : SceneDataHandler::infoFromDisk(path, serverID);
+
+	// only the versions are picked here, the parts are loaded through the cache on their first request
+	bool empty = true;
+	for (int i = 0; i < SceneDataHandler::s_partCount; i++)
+	{
+		QString version;
+		if (!fileNames[i].isEmpty())
+			version = fileNames[i][0].chopped(SceneDataHandler::partSuffix(i).size());
+
+		empty &= version.isEmpty();
+		scene->versions.append(version);
+	}
+
+	if (empty)
+		qInfo() << "No scene files found for" << serverID;
+	else
+		qInfo() << "Serving scene of" << serverID;
+
+	return scene;
+}
+
+bool SceneSender::isReceiving(const Scene& scene) const
+{
+	return !scene.stamp.isEmpty() && m_receiving.contains(receivingKey(scene.serverID, scene.stamp));
+}
+
+SceneSender::Scene& SceneSender::download(const std::string& identity)
+{
+	Download& download = m_downloads[identity];
+	if (!download.scene)
+		download.scene = m_scene;
+	download.lastRequest = m_clock.elapsed();
+	return *download.scene;
+}
+
+void SceneSender::expireDownloads()
+{
+	const qint64 now = m_clock.elapsed();
+	for (auto download = m_downloads.begin(); download != m_downloads.end();)
+	{
+		// clients with requests or replies in flight are still downloading
+		const bool busy = isWaiting(download->first) || std::any_of(m_pending.begin(), m_pending.end(), [&](const PendingReply& reply) { return reply.identity == download->first; });
+		if (!busy && now - download->second.lastRequest > s_downloadTimeout)
+			download = m_downloads.erase(download);
+		else
+			++download;
+	}
+}
+
+int SceneSender::partIndex(const std::string& request)
+{
+	static const std::string requests[SceneDataHandler::s_partCount] = { "header", "nodes", "parameterobjects", "objects", "characters", "textures", "materials" };
+
+	for (int i = 0; i < SceneDataHandler::s_partCount; i++)
+		if (request == requests[i])
+			return i;
+
+	return -1;
+}
+
+SharedBuffer::Pointer SceneSender::response(const Scene& scene, const std::string& request)
 {
-	if (!loadData()) {
-		qInfo("Error loading Scene Files!");
+	const int index = partIndex(request);
+	if (index < 0 || index >= scene.versions.size() || scene.versions[index].isEmpty())
+		return SharedBuffer::Pointer();
+
+	if (m_partCache)
+		return m_partCache->part(scene.serverID, scene.versions[index], index);
+
+	const QString path = m_sceneCatalog ? m_sceneCatalog->path() : "./";
+	return SceneDataHandler::mapPart(path, scene.serverID, scene.versions[index], index);
+}
+
+quint64 SceneSender::checksum(Scene& scene, int index, const SharedBuffer::Pointer& part)
+{
+	const qint64 size = part ? part->size() : 0;
+
+	const QSharedPointer<SceneManifest> manifest = this->manifest(scene, index);
+	if (manifest && manifest->parts()[index].size == size)
+		return manifest->parts()[index].checksum;
+
+	// parts without manifest are hashed once per served scene
+	auto checksum = scene.checksums.constFind(index);
+	if (checksum != scene.checksums.constEnd())
+		return checksum.value();
+
+	const quint64 hash = part ? Hash::xxh64(part->data(), size) : Hash::xxh64(nullptr, 0);
+	scene.checksums.insert(index, hash);
+	return hash;
+}
+
+bool SceneSender::addChunk(zmq::multipart_t& reply, const std::string& request, Scene& scene, const SharedBuffer::Pointer& part, int index, qint64 offset)
+{
+	const qint64 total = part ? part->size() : 0;
+	const quint64 partChecksum = checksum(scene, index, part);
+
+	if (offset < 0 || offset > total)
+		offset = total;
+
+	const qint64 size = qMin<qint64>(SceneDataHandler::s_chunkSize, total - offset);
+
+	// total size of the part, offset of the chunk, checksum of the part, then the chunk
+	reply.addmem(&total, sizeof(qint64));
+	reply.addmem(&offset, sizeof(qint64));
+	reply.addmem(&partChecksum, sizeof(quint64));
+	if (size > 0)
+		reply.add(SharedBuffer::message(part, offset, size));
+	else
+		reply.add(zmq::message_t());
+
+	if (m_debug)
+		qInfo() << request << " chunk " << offset << " with size: " << size << " of " << total << " sended.";
+
+	return offset + size == total;
+}
+
+QSharedPointer<SceneManifest> SceneSender::manifest(Scene& scene, int index)
+{
+	if (index < 0 || index >= scene.versions.size() || scene.versions[index].isEmpty())
+		return QSharedPointer<SceneManifest>();
+
+	const QString& version = scene.versions[index];
+	QSharedPointer<SceneManifest> manifest = scene.manifests.value(version);
+	if (!manifest)
+	{
+		// versions stored before manifests were used, or not stored yet, are sent whole
+		const QString path = m_sceneCatalog ? m_sceneCatalog->path() : "./";
+		manifest = SceneManifest::open(path + scene.serverID + "/" + version + SceneManifest::s_extension);
+		if (manifest && index < manifest->parts().size())
+			scene.manifests.insert(version, manifest);
+		else
+			manifest.reset();
+	}
+
+	return manifest;
+}
+
+void SceneSender::addDelta(zmq::multipart_t& reply, const std::string& request, const SharedBuffer::Pointer& data, int index, const QSharedPointer<SceneManifest>& manifest, const zmq::message_t* known)
+{
+	const qint64 size = data ? data->size() : 0;
+
+	if (manifest && manifest->parts()[index].size == size)
+	{
+		const SceneManifest::Part& part = manifest->parts()[index];
+
+		// chunks the client has are skipped, chunks repeated within the part are sent once
+		QSet<ChunkStore::Chunk> skipped;
+		if (known && known->size() % ChunkStore::s_encodedChunkSize == 0)
+		{
+			foreach(const ChunkStore::Chunk& chunk, ChunkStore::decode(known->data(), known->size() / ChunkStore::s_encodedChunkSize))
+				skipped.insert(chunk);
+		}
+
+		const qsizetype knownCount = skipped.size();
+		const QByteArray entry = SceneManifest::encode(part);
+		reply.addmem(entry.constData(), entry.size());
+
+		// the chunks are ranges of the mapped part
+		qint64 offset = 0;
+		qint64 sent = 0;
+		foreach(const ChunkStore::Chunk& chunk, part.chunks)
+		{
+			if (!skipped.contains(chunk))
+			{
+				skipped.insert(chunk);
+				reply.add(SharedBuffer::message(data, offset, chunk.size));
+				sent += chunk.size;
+			}
+			offset += chunk.size;
+		}
+
+		qInfo() << request << " delta with " << sent << " of " << part.size << " bytes sended, " << knownCount << " chunks known.";
 		return;
 	}
 
-	zmq::socket_t socket(*m_context, ZMQ_REP);
-	//socket.setsockopt(ZMQ_RCVTIMEO, 100);
+	// without a manifest matching the part it is sent whole after an empty part entry
+	reply.add(zmq::message_t());
+	reply.add(SharedBuffer::message(data));
+
+	qInfo() << request << " without delta with size: " << size << " sended.";
+}
+
+bool SceneSender::isWaiting(const std::string& identity) const
+{
+	for (const zmq::multipart_t& request : m_waiting)
+		if (request[0].to_string() == identity)
+			return true;
+
+	return false;
+}
+
+bool SceneSender::handleRequest(zmq::socket_t& socket, const zmq::multipart_t& request)
+{
+	// ROUTER envelope of a REQ client: identity, empty delimiter, request
+	if (request.size() < 3)
+		return true;
+
+	const std::string identity = request[0].to_string();
+	const std::string command = request[2].to_string();
+
+	// chunked requests carry the offset of the wanted chunk, delta requests the word delta
+	const size_t separator = command.find(':');
+	const std::string name = command.substr(0, separator);
+	const int index = partIndex(name);
+	const bool delta = separator != std::string::npos && command.compare(separator + 1, std::string::npos, "delta") == 0;
+
+	// the client is served the scene it started its download with
+	Scene& scene = download(identity);
+	const QSharedPointer<SceneManifest> manifest = delta ? this->manifest(scene, index) : QSharedPointer<SceneManifest>();
+	const SharedBuffer::Pointer part = response(scene, name);
+
+	// parts of a relayed scene wait until they arrived, later requests
+	// of the same client wait behind them to keep the reply order
+	if (isReceiving(scene) && ((!manifest && !part && index >= 0) || isWaiting(identity)))
+		return false;
+
+	zmq::multipart_t reply;
+	reply.addmem(identity.data(), identity.size());
+	reply.add(zmq::message_t());
+
+	// the scene is downloaded part by part, it is complete with the end of the last part
+	bool last = index == SceneDataHandler::s_partCount - 1;
+
+	if (delta)
+		addDelta(reply, name, part, index, manifest, request.size() > 3 ? &request[3] : nullptr);
+	else if (separator != std::string::npos)
+		last &= addChunk(reply, name, scene, part, index, QByteArray::fromStdString(command.substr(separator + 1)).toLongLong());
+	else
+	{
+		qInfo() << "Received request: " << command;
+
+		// every request is answered, missing parts with an empty message
+		reply.add(SharedBuffer::message(part));
+
+		qInfo() << command << " with size: " << (part ? part->size() : 0) << + " sended.";
+	}
+
+	const QString serverID = scene.serverID;
+
+	// the next request starts a download of the scene published by then
+	if (last)
+		m_downloads.erase(identity);
+
+	sendReply(socket, identity, std::move(reply), last, serverID);
+	return true;
+}
+
+void SceneSender::handleWaiting(zmq::socket_t& socket)
+{
+	std::deque<zmq::multipart_t> waiting;
+	waiting.swap(m_waiting);
+
+	std::vector<std::string> blocked;
+	for (zmq::multipart_t& request : waiting)
+	{
+		const std::string identity = request[0].to_string();
+		if (std::find(blocked.begin(), blocked.end(), identity) == blocked.end() && handleRequest(socket, request))
+			continue;
+
+		blocked.push_back(identity);
+		m_waiting.push_back(std::move(request));
+	}
+}
+
+bool SceneSender::trySend(zmq::socket_t& socket, zmq::multipart_t& reply)
+{
+	// multipart_t::send drops the frame it failed to send, so the parts are sent one by one
+	try
+	{
+		while (!reply.empty())
+		{
+			zmq::message_t part = reply.pop();
+			const zmq::send_flags flags = reply.empty() ? zmq::send_flags::dontwait : zmq::send_flags::dontwait | zmq::send_flags::sndmore;
+			if (!socket.send(part, flags))
+			{
+				// the send queue is full, the reply is retried as a whole
+				reply.push(std::move(part));
+				return false;
+			}
+		}
+	}
+	catch (const zmq::error_t&)
+	{
+		// the client disconnected, its reply is dropped
+		reply.clear();
+	}
+
+	return true;
+}
+
+void SceneSender::sendReply(zmq::socket_t& socket, const std::string& identity, zmq::multipart_t&& reply, bool last, const QString& serverID)
+{
+	// a client with pending replies gets this one after them
+	for (const PendingReply& pending : m_pending)
+	{
+		if (pending.identity == identity)
+		{
+			m_pending.push_back(PendingReply{ identity, std::move(reply), last, serverID });
+			return;
+		}
+	}
+
+	if (!trySend(socket, reply))
+		m_pending.push_back(PendingReply{ identity, std::move(reply), last, serverID });
+	else if (last)
+		emit sceneSent(serverID);
+}
+
+void SceneSender::sendPending(zmq::socket_t& socket)
+{
+	std::deque<PendingReply> pending;
+	pending.swap(m_pending);
+
+	std::vector<std::string> blocked;
+	for (PendingReply& reply : pending)
+	{
+		if (std::find(blocked.begin(), blocked.end(), reply.identity) == blocked.end() && trySend(socket, reply.reply))
+		{
+			if (reply.last)
+				emit sceneSent(reply.serverID);
+			continue;
+		}
+
+		blocked.push_back(reply.identity);
+		m_pending.push_back(std::move(reply));
+	}
+}
+
+void SceneSender::run()
+{
+	zmq::socket_t socket(*m_context, ZMQ_ROUTER);
+	// report full send queues and unknown clients instead of silently dropping replies
+	socket.setsockopt(ZMQ_ROUTER_MANDATORY, 1);
 
 	QString address = "tcp://" + m_IPadress + ":5555";
 	socket.bind(address.toLatin1().data());
 
+	zmq::pollitem_t item = { static_cast<void*>(socket), 0, ZMQ_POLLIN, 0 };
+
 	startInfo(address);
 
 	while (true) {
@@ -80,32 +449,49 @@ void SceneSender::run()
 		bool stop = m_stop;
 		m_mutex.unlock();
 
-		zmq::message_t message;
-		socket.recv(&message);
+		m_sceneMutex.lock();
+		const bool published = m_scenePublished;
+		const QString serverID = m_publishedScene;
+		const QString stamp = m_publishedStamp;
+		m_receiving = m_receivingScenes;
+		m_scenePublished = false;
+		m_sceneMutex.unlock();
+
+		// clients in the middle of a download keep their scene
+		if (published)
+			m_scene = loadScene(serverID, stamp);
 
-		if (message.size() > 0)
+		// requests for relayed parts are answered as soon as the parts arrived
+		if (!m_waiting.empty())
+			handleWaiting(socket);
+
+		zmq::poll(&item, 1, std::chrono::milliseconds(m_pending.empty() && m_waiting.empty() ? 100 : s_retryInterval));
+
+		if (item.revents & ZMQ_POLLIN)
 		{
-			std::string request = message.to_string();
-			
-			qInfo() << "Received request: " << request;
-			
-			auto response = m_responses.find(request);
-			if (response != m_responses.end())
+			zmq::multipart_t request;
+			while (request.recv(socket, ZMQ_DONTWAIT))
 			{
-				const QByteArray* dataArray = response.value();
-				socket.send(zmq::message_t(dataArray->data(), dataArray->size()));
-
-				qInfo() << request << " with size: " << dataArray->size() << + " sended.";
+				if (!handleRequest(socket, request))
+					m_waiting.push_back(std::move(request));
+				request.clear();
 			}
 		}
 
+		if (!m_pending.empty())
+			sendPending(socket);
+
+		expireDownloads();
+
 		if (stop) {
 			break;
 		}
-
-		QThread::yieldCurrentThread();
 	}
 
+	m_pending.clear();
+	m_waiting.clear();
+	m_downloads.clear();
+
 	m_mutex.lock();
 	m_working = false;
 	m_mutex.unlock();
@@ -113,4 +499,4 @@ void SceneSender::run()
 	stopInfo(address);
 
 	emit stopped(this);
-}
\ No newline at end of file
+}